@@ -273,7 +273,9 @@ module cosmac (
                     1'b0;
    
    // r_p
-   always @(clk_enable or posedge clk) begin
+   always @(posedge clk) begin
+      if (clk_enable == 1'b1)
+      begin
          if (waiting == 1'b0)
          begin
             if (r_write_low == 1'b1)
@@ -281,6 +283,7 @@ module cosmac (
             if (r_write_high == 1'b1)
                r_high[r_addr] <= r_write_data[15:8];
          end
+      end
    end
    
    // xp_p
@@ -124,8 +124,9 @@ always @(posedge clk_sys) begin
 		endcase
 	end
 end
-reg  [9:0] playerA = 10'h0;
-reg  [9:0] playerB = 10'h0;
+// Public so the simulator can also set the keypads directly
+reg  [9:0] playerA /*verilator public_flat_rw*/ = 10'h0;
+reg  [9:0] playerB /*verilator public_flat_rw*/ = 10'h0;
 
 ////////////////// CPU //////////////////////////////////////////////////////////////////
 
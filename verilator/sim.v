@@ -53,6 +53,24 @@ module top(
    assign AUDIO_L = {audio,audio};
    assign AUDIO_R = AUDIO_L;
 
+   // Beeper: the Studio II gates a ~625 Hz 555 oscillator with the 1802 Q line.
+   // clk_48 ticks once per 1.76 MHz core clock (clk_sys_freq in sim_core.cpp)
+   localparam CLK_SYS_FREQ = 1760000;
+   localparam BEEP_DIVIDER = CLK_SYS_FREQ / (625 * 2);
+   reg [15:0] beep_count = 0;
+   reg beep = 0;
+   always @(posedge clk_48) begin
+      if (beep_count == BEEP_DIVIDER - 1) begin
+         beep_count <= 0;
+         beep <= ~beep;
+      end
+      else beep_count <= beep_count + 1'b1;
+   end
+   assign audio = rcastudio.Q ? (beep ? 8'h20 : 8'hE0) : 8'h00;
+
+// clk_48 is the core's clk_sys, and the core runs one CPU/Pixie clock per
+// edge (clk_1m76 and clk_vid are unused), so each clk_48 cycle stands for
+// one 1.76 MHz Studio II clock; see clk_sys_freq in sim_core.cpp
 wire ce_pix = 1'b1;
 wire reset = ioctl_download;
 
@@ -1,18 +1,103 @@
 #include "sim_audio.h"
+#include "sim_wav.h"
+#include "sim_lockfree.h"
+#include "sim_resampler.h"
 #include <iostream>
-#include <fstream>
 #include <list>
+// Live output uses SDL audio, which only the SDL (non-Windows) GUI build has
+#if !defined(SIM_HEADLESS) && !defined(_MSC_VER)
+#define SIM_AUDIO_SDL
+#include <SDL.h>
+#endif
 using namespace std;
 
-SimClock clk;
-bool outputToFile;
-ofstream audioFile;
+SimWavWriter audioFile;
+
+// Live output
+// -----------
+// Clock() pushes each sample into an SPSC ring and never waits (a full ring
+// drops the sample). The SDL callback drains it, resampling with a variable
+// read ratio: a smoothed estimate of how many samples the sim produced per
+// output sample, corrected by how far the ring is from live_target. That
+// follows the sim speed as it varies, and underruns repeat the last sample
+// instead of clicking.
+struct SimAudio_Sample {
+	int16_t l;
+	int16_t r;
+};
+SimRing<SimAudio_Sample, 8192> live_ring;
+const int live_target = 2048;
+const float live_gain = 0.25f;		// Fill correction at a full ring of error
+const float live_smoothing = 0.05f;	// Weight of the newest rate estimate
+const float live_ratio_min = 0.01f;
+const float live_ratio_max = 4.0f;
+float live_ratio = 1.0f;
+float live_rate = 1.0f;
+float live_pos = 0.0f;
+int live_last_fill = 0;
+int live_consumed = 0;
+SimAudio_Sample live_prev = { 0, 0 };
+SimAudio_Sample live_cur = { 0, 0 };
+#ifdef SIM_AUDIO_SDL
+SDL_AudioDeviceID live_device = 0;
+#endif
+
+// Decimator from the system clock to sample_rate
+SimResampler resampler;
+static int clock_frequency;
 
 SimAudio::SimAudio(int systemClockFrequency, bool saveToFile)
 {
-	clk = SimClock(systemClockFrequency / 44100);
-	outputToFile = saveToFile;
+	clock_frequency = systemClockFrequency;
+	save_to_file = saveToFile;
+	sample_rate = 44100;
+	sample_float = false;
+	filename = "audio.wav";
+	live_output = true;
+	debug_pos = 0;
+}
+
+static int16_t toSample(float value) {
+	if (value > 1.0f) { value = 1.0f; }
+	if (value < -1.0f) { value = -1.0f; }
+	return (int16_t)(value * 32767.0f);
+}
+
+#ifdef SIM_AUDIO_SDL
+static void liveCallback(void* userdata, Uint8* stream, int len) {
+	SimAudio* audio = (SimAudio*)userdata;
+	int16_t* out = (int16_t*)stream;
+	int frames = len / (int)sizeof(SimAudio_Sample);
+
+	// Samples produced since the last callback, per output sample
+	int fill = (int)live_ring.Count();
+	float produced = (float)(fill - live_last_fill) / frames;
+	live_rate += (produced - live_rate) * live_smoothing;
+
+	// Read faster when above target, slower when below
+	float error = (float)(fill - live_target) / live_target;
+	live_ratio = live_rate * (1.0f + live_gain * error);
+	if (live_ratio < live_ratio_min) { live_ratio = live_ratio_min; }
+	if (live_ratio > live_ratio_max) { live_ratio = live_ratio_max; }
+
+	live_consumed = 0;
+	for (int f = 0; f < frames; f++) {
+		live_pos += live_ratio;
+		while (live_pos >= 1.0f) {
+			live_prev = live_cur;
+			if (live_ring.Pop(live_cur)) { live_consumed++; }
+			else { audio->stats_underruns.fetch_add(1, std::memory_order_relaxed); }
+			live_pos -= 1.0f;
+		}
+		// Linear interpolation between the last two input samples
+		out[f * 2] = (int16_t)(live_prev.l + (live_cur.l - live_prev.l) * live_pos);
+		out[f * 2 + 1] = (int16_t)(live_prev.r + (live_cur.r - live_prev.r) * live_pos);
+	}
+	live_last_fill = fill - live_consumed;
+	audio->stats_fill.store((float)fill / 8192, std::memory_order_relaxed);
+	audio->stats_ratio.store(live_ratio, std::memory_order_relaxed);
 }
+#endif
 
 SimAudio::~SimAudio()
 {
@@ -20,12 +105,20 @@ SimAudio::~SimAudio()
 }
 
 void SimAudio::Clock(signed short left, signed short right) {
-	clk.Tick();
-	if (clk.IsRising()) {
-		// Output audio (left channel only for now)
-		float l = left / 32768.0f;
-		if (outputToFile) {
-			audioFile.write((const char*)&l, sizeof(float));
+	// Nothing to feed: skip the filter, it costs more than the core per clock
+	if (!save_to_file && !live_output) { return; }
+	if (resampler.Clock(left, right)) { Output(); }
+}
+
+// Hand the last decimated block to the file and live outputs
+void SimAudio::Output() {
+	const float* samples = resampler.output.data();
+	for (int i = 0; i < resampler.output_count; i++, samples += 2) {
+		if (save_to_file) {
+			audioFile.Write(samples);
+		}
+		if (live_output) {
+			live_ring.Push({ toSample(samples[0]), toSample(samples[1]) });
 		}
 	}
 }
@@ -47,16 +140,51 @@ void SimAudio::Initialise() {
 		debug_wave_r[c] = 0;
 		debug_positions[c] = (double)c / (double)debug_max_samples;
 	}
-	if (outputToFile)
+	resampler.Initialise(clock_frequency, sample_rate);
+#ifdef SIM_AUDIO_SDL
+	if (live_output)
+	{
+		// Open SDL audio at the sample rate, the callback does the rest
+		SDL_AudioSpec want, have;
+		SDL_zero(want);
+		want.freq = sample_rate;
+		want.format = AUDIO_S16SYS;
+		want.channels = 2;
+		want.samples = 512;
+		want.callback = liveCallback;
+		want.userdata = this;
+		if (SDL_InitSubSystem(SDL_INIT_AUDIO) != 0 || (live_device = SDL_OpenAudioDevice(NULL, 0, &want, &have, 0)) == 0) {
+			cerr << "Cannot open audio device: " << SDL_GetError() << endl;
+			live_output = false;
+		}
+		else {
+			SDL_PauseAudioDevice(live_device, 0);
+		}
+	}
+#else
+	live_output = false;
+#endif
+	if (save_to_file)
 	{
 		// Setup Audio output stream
-		audioFile.open("audio.wav", ios::binary);
+		if (!audioFile.Open(filename.c_str(), sample_rate, 2, sample_float)) {
+			cerr << "Cannot write audio file " << filename << endl;
+		}
 	}
 }
 void SimAudio::CleanUp() {
-	if (outputToFile)
+#ifdef SIM_AUDIO_SDL
+	if (live_device)
+	{
+		SDL_CloseAudioDevice(live_device);
+		live_device = 0;
+	}
+#endif
+	resampler.Flush();
+	Output();
+	if (save_to_file)
 	{
-		audioFile.close();
+		audioFile.Close();
 	}
 }
 
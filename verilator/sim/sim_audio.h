@@ -1,23 +1,38 @@
 #pragma once
 
 #include <string>
-#include "sim_clock.h"
+#include <atomic>
+#include <stdint.h>
 
 struct SimAudio {
 public:
 
-	SimClock clock;
-	
 	static const unsigned short debug_max_samples = 600;
 	float debug_positions[debug_max_samples];
 	float debug_wave_l[debug_max_samples];
 	float debug_wave_r[debug_max_samples];
 	int debug_pos;
 
+	// Output settings, change before Initialise()
+	int sample_rate;
+	bool save_to_file;
+	bool sample_float;	// 32-bit float WAV instead of 16-bit PCM
+	std::string filename;
+	bool live_output;	// Play through SDL (not in headless builds)
+
+	// Live output status, written by the SDL callback and read on any thread
+	std::atomic<float> stats_fill{ 0 };	// Ring fill level, 0..1
+	std::atomic<float> stats_ratio{ 1.0f };	// Input samples consumed per output sample
+	std::atomic<int> stats_underruns{ 0 };
+
 	SimAudio(int systemClockFrequency, bool saveToFile);
 	~SimAudio();
+	// One sample per system clock, decimated to sample_rate in blocks
 	void Clock(signed short left, signed short right);
 	void CollectDebug(signed short left, signed short right);
 	void Initialise();
 	void CleanUp();
+
+private:
+	void Output();
 };
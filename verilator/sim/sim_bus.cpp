@@ -1,6 +1,8 @@
 #include <iostream>
 #include <queue>
 #include <string>
+#include <vector>
+#include <string.h>
 
 #include "sim_bus.h"
 #include "sim_console.h"
@@ -14,20 +16,21 @@
 
 static DebugConsole console;
 
-FILE* ioctl_file = NULL;
-int ioctl_next_addr = -1;
-int ioctl_last_index = -1;
+// Clocks to hold ioctl_download (core reset) after a fast load
+const int fast_load_reset_cycles = 16;
 
-IData* ioctl_addr = NULL;
-CData* ioctl_index = NULL;
-CData* ioctl_wait = NULL;
-CData* ioctl_download = NULL;
-CData* ioctl_upload = NULL;
-CData* ioctl_wr = NULL;
-CData* ioctl_dout = NULL;
-CData* ioctl_din = NULL;
-
-std::queue<SimBus_DownloadChunk> downloadQueue;
+SimBus_Image SimBus_ReadImage(const std::string& file) {
+	FILE* f = fopen(file.c_str(), "rb");
+	if (!f) { return NULL; }
+	fseek(f, 0, SEEK_END);
+	long length = ftell(f);
+	fseek(f, 0, SEEK_SET);
+	std::shared_ptr<std::vector<unsigned char>> image = std::make_shared<std::vector<unsigned char>>(length > 0 ? length : 0);
+	size_t read = image->size() ? fread(image->data(), 1, image->size(), f) : 0;
+	fclose(f);
+	image->resize(read);
+	return image;
+}
 
 void SimBus::QueueDownload(std::string file, int index) {
 	SimBus_DownloadChunk chunk = SimBus_DownloadChunk(file, index);
@@ -37,59 +40,223 @@ void SimBus::QueueDownload(std::string file, int index, bool restart) {
 	SimBus_DownloadChunk chunk = SimBus_DownloadChunk(file, index, restart);
 	downloadQueue.push(chunk);
 }
+void SimBus::QueueDownload(SimBus_Image image, std::string name, int index, bool restart) {
+	SimBus_DownloadChunk chunk = SimBus_DownloadChunk(name, index, restart);
+	chunk.image = image;
+	downloadQueue.push(chunk);
+}
+
+// ST2 cartridge (docs/cartridge.txt): a 256 byte header starting with "RCA2",
+// the block count (including the header) at 4 and the target page of each
+// following 256 byte block at 64-127. Every block is queued as its own
+// chunk at index 1, addressed so it lands on its page.
+bool SimBus::QueueST2(std::string file) {
+	const size_t block_size = 256;
+	const size_t max_blocks = 64;
+	const int cart_base = 0x400;
+
+	SimBus_Image image = SimBus_ReadImage(file);
+	if (!image) {
+		console.AddLog("Cannot open file for download %s\n", file.c_str());
+		return false;
+	}
+	const std::vector<unsigned char>& data = *image;
+	if (data.size() < block_size || memcmp(data.data(), "RCA2", 4) != 0) {
+		console.AddLog("Not an ST2 cartridge: %s", file.c_str());
+		return false;
+	}
+	size_t blocks = data[4];
+	if (blocks < 1 || blocks - 1 > max_blocks || data.size() < blocks * block_size) {
+		console.AddLog("ST2 block count %d does not match file size %d: %s", (int)blocks, (int)data.size(), file.c_str());
+		return false;
+	}
+
+	for (size_t block = 1; block < blocks; block++) {
+		// Pages repeat in every 4k, only 4-7, A-B and E-F hold ROM
+		int page = data[64 + block - 1] & 0x0F;
+		if (page < 0x04 || page == 0x08 || page == 0x09 || page == 0x0C || page == 0x0D) {
+			console.AddLog("ST2 block %d has invalid page %02X, skipped", (int)block, data[64 + block - 1]);
+			continue;
+		}
+		const unsigned char* start = data.data() + block * block_size;
+		SimBus_DownloadChunk chunk = SimBus_DownloadChunk(file, 1, true);
+		chunk.image = std::make_shared<std::vector<unsigned char>>(start, start + block_size);
+		chunk.address = ((page << 8) - cart_base) & 0xFFF;
+		downloadQueue.push(chunk);
+	}
+	console.AddLog("ST2 cartridge %s: %d blocks", file.c_str(), (int)blocks - 1);
+	return true;
+}
+
 bool SimBus::HasQueue() {
 	return downloadQueue.size() > 0;
 }
 
-int nextchar = 0;
-void SimBus::BeforeEval()
+// Take the next chunk from the queue and read its file if it was queued by
+// name. Returns false if the file cannot be read.
+bool SimBus::NextDownload()
 {
-	// If no file is open and there is a download queued
-	if (!ioctl_file && downloadQueue.size() > 0) {
+	currentDownload = downloadQueue.front();
+	downloadQueue.pop();
+
+	// If last index differs from this one then reset the addresses
+	if (currentDownload.index != *ioctl_index) { ioctl_next_addr = -1; }
+	// if we want to restart the ioctl_addr then reset it
+	// leave it the same if we want to be able to load two roms sequentially
+	if (currentDownload.restart) { ioctl_next_addr = -1; }
+	if (currentDownload.address >= 0) { ioctl_next_addr = currentDownload.address - 1; }
+	*ioctl_index = currentDownload.index;
+
+	if (!currentDownload.image) { currentDownload.image = SimBus_ReadImage(currentDownload.file); }
+	if (!currentDownload.image) {
+		console.AddLog("Cannot open file for download %s\n", currentDownload.file.c_str());
+		return false;
+	}
+	return true;
+}
+
+// Copy the current download into RAM at the same address the ioctl path
+// would use: index 0 at 0x000, any other index at 0x400
+void SimBus::FastLoad()
+{
+	const std::vector<unsigned char>& data = *currentDownload.image;
+	size_t length = data.size() < (size_t)ram_size ? data.size() : (size_t)ram_size;
+
+	int base = ((currentDownload.index > 0 ? 0x400 : 0) + ioctl_next_addr + 1) & (ram_size - 1);
+	if (base + length <= (size_t)ram_size) {
+		memcpy(ram + base, data.data(), length);
+	}
+	else {
+		for (size_t i = 0; i < length; i++) {
+			ram[(base + i) & (ram_size - 1)] = data[i];
+		}
+	}
+	ioctl_next_addr += (int)length;
+	console.AddLog("Fast load complete: %s %d bytes", currentDownload.file.c_str(), (int)length);
+}
+
+// Save states
+// -----------
+
+static void saveImage(VerilatedSerialize& os, const SimBus_Image& image) {
+	bool present = image != NULL;
+	os << present;
+	if (!present) { return; }
+	vluint32_t size = (vluint32_t)image->size();
+	os << size;
+	os.write(image->data(), size);
+}
 
-		// Get chunk from queue
-		currentDownload = downloadQueue.front();
+static SimBus_Image loadImage(VerilatedDeserialize& os) {
+	bool present;
+	os >> present;
+	if (!present) { return NULL; }
+	vluint32_t size;
+	os >> size;
+	std::shared_ptr<std::vector<unsigned char>> image = std::make_shared<std::vector<unsigned char>>(size);
+	os.read(image->data(), size);
+	return image;
+}
+
+static void saveChunk(VerilatedSerialize& os, SimBus_DownloadChunk& chunk) {
+	os << chunk.file << chunk.restart;
+	os.write(&chunk.index, sizeof(chunk.index));
+	os.write(&chunk.address, sizeof(chunk.address));
+	saveImage(os, chunk.image);
+}
+
+static void loadChunk(VerilatedDeserialize& os, SimBus_DownloadChunk& chunk) {
+	os >> chunk.file >> chunk.restart;
+	os.read(&chunk.index, sizeof(chunk.index));
+	os.read(&chunk.address, sizeof(chunk.address));
+	chunk.image = loadImage(os);
+}
+
+void SimBus::SaveState(VerilatedSerialize& os) {
+	vluint64_t pos = ioctl_pos;
+	os << pos;
+	os.write(&ioctl_next_addr, sizeof(ioctl_next_addr));
+	os.write(&ioctl_last_index, sizeof(ioctl_last_index));
+	os.write(&fast_load_reset, sizeof(fast_load_reset));
+	saveImage(os, ioctl_image);
+	saveChunk(os, currentDownload);
+
+	// Walk the queue by rotating it once
+	vluint32_t count = (vluint32_t)downloadQueue.size();
+	os << count;
+	for (vluint32_t i = 0; i < count; i++) {
+		SimBus_DownloadChunk chunk = downloadQueue.front();
 		downloadQueue.pop();
+		saveChunk(os, chunk);
+		downloadQueue.push(chunk);
+	}
+}
 
-		// If last index differs from this one then reset the addresses
-		if (currentDownload.index != *ioctl_index) { ioctl_next_addr = -1; }
-		// if we want to restart the ioctl_addr then reset it
-		// leave it the same if we want to be able to load two roms sequentially
-		if (currentDownload.restart) { ioctl_next_addr = -1; }
-		// Set address and index
-		*ioctl_addr = ioctl_next_addr;
-		*ioctl_index = currentDownload.index;
-
-		// Open file
-		ioctl_file = fopen(currentDownload.file.c_str(), "rb");
-		if (!ioctl_file) {
-			console.AddLog("Cannot open file for download %s\n", currentDownload.file.c_str());
+void SimBus::LoadState(VerilatedDeserialize& os) {
+	vluint64_t pos;
+	os >> pos;
+	ioctl_pos = (size_t)pos;
+	os.read(&ioctl_next_addr, sizeof(ioctl_next_addr));
+	os.read(&ioctl_last_index, sizeof(ioctl_last_index));
+	os.read(&fast_load_reset, sizeof(fast_load_reset));
+	ioctl_image = loadImage(os);
+	loadChunk(os, currentDownload);
+
+	vluint32_t count;
+	os >> count;
+	downloadQueue = std::queue<SimBus_DownloadChunk>();
+	for (vluint32_t i = 0; i < count; i++) {
+		SimBus_DownloadChunk chunk;
+		loadChunk(os, chunk);
+		downloadQueue.push(chunk);
+	}
+}
+
+void SimBus::BeforeEval()
+{
+	// Fast load everything queued, then hold the core in reset for a few clocks
+	if (fast_load && ram && !ioctl_image) {
+		if (downloadQueue.size() > 0) {
+			if (NextDownload()) { FastLoad(); }
+			fast_load_reset = fast_load_reset_cycles;
 		}
-		else {
-			console.AddLog("Starting download: %s %d", currentDownload.file.c_str(), ioctl_next_addr, ioctl_next_addr);
+		if (fast_load_reset > 0) {
+			fast_load_reset--;
+			*ioctl_download = 1;
+			*ioctl_wr = 0;
+			return;
 		}
 	}
 
-	if (ioctl_file) {
+	// If no download is running and there is one queued
+	if (!ioctl_image && downloadQueue.size() > 0) {
+		if (NextDownload()) {
+			ioctl_image = currentDownload.image;
+			ioctl_pos = 0;
+			*ioctl_addr = ioctl_next_addr;
+			console.AddLog("Starting download: %s %d", currentDownload.file.c_str(), ioctl_next_addr);
+		}
+	}
+
+	if (ioctl_image) {
 		//console.AddLog("ioctl_download addr %x  ioctl_wait %x", *ioctl_addr, *ioctl_wait);
 		if (*ioctl_wait == 0) {
 			*ioctl_download = 1;
 			*ioctl_wr = 1;
-			if (feof(ioctl_file)) {
-				fclose(ioctl_file);
-				ioctl_file = NULL;
+			if (ioctl_pos < ioctl_image->size()) {
+				ioctl_pos++;
+				ioctl_next_addr++;
+			}
+			else if (ioctl_pos == ioctl_image->size()) {
+				// One more write cycle so the last byte is clocked in
+				ioctl_pos++;
+			}
+			else {
+				ioctl_image = NULL;
 				*ioctl_download = 0;
 				*ioctl_wr = 0;
 				console.AddLog("ioctl_download complete %d", ioctl_next_addr);
 			}
-			if (ioctl_file) {
-				int curchar = fgetc(ioctl_file);
-				if (feof(ioctl_file) == 0) {
-					nextchar = curchar;
-					//console.AddLog("ioctl_download: dout %x \n", *ioctl_dout);
-					ioctl_next_addr++;
-				}
-			}
 		}
 	}
 	else {
@@ -101,9 +268,8 @@ void SimBus::BeforeEval()
 void SimBus::AfterEval()
 {
 	*ioctl_addr = ioctl_next_addr;
-	*ioctl_dout = (unsigned char)nextchar;
-	if (ioctl_file) {
-		//	console.AddLog("ioctl_download %x wr %x dl %x\n", *ioctl_addr, *ioctl_wr, *ioctl_download);
+	if (ioctl_image && ioctl_pos > 0 && ioctl_pos <= ioctl_image->size()) {
+		*ioctl_dout = (*ioctl_image)[ioctl_pos - 1];
 	}
 }
 
@@ -118,6 +284,13 @@ SimBus::SimBus(DebugConsole c) {
 	ioctl_wr = NULL;
 	ioctl_dout = NULL;
 	ioctl_din = NULL;
+	ram = NULL;
+	ram_size = 0;
+	fast_load = false;
+	ioctl_pos = 0;
+	ioctl_next_addr = -1;
+	ioctl_last_index = -1;
+	fast_load_reset = 0;
 }
 
 SimBus::~SimBus() {
@@ -1,6 +1,9 @@
 #pragma once
 #include <queue>
+#include <memory>
+#include <vector>
 #include "verilated_heavy.h"
+#include "verilated_save.h"
 #include "sim_console.h"
 
 
@@ -9,26 +12,36 @@
 #define WIN32
 #endif
 
+// Whole file image, read once and shared by every chunk (and SimBus) it is
+// queued into
+typedef std::shared_ptr<const std::vector<unsigned char>> SimBus_Image;
+SimBus_Image SimBus_ReadImage(const std::string& file);
+
 struct SimBus_DownloadChunk {
 public:
 	std::string file;
 	int index;
 	bool restart;
+	int address;	// ioctl_addr to start at, -1 to follow index/restart
+	SimBus_Image image;
 	
 	SimBus_DownloadChunk() {
 		file = "";
 		index = -1;
+		address = -1;
 	}
 
 	SimBus_DownloadChunk(std::string file, int index) {
 		this->restart = false;
 		this->file = std::string(file);
 		this->index = index;
+		this->address = -1;
 	}
 	SimBus_DownloadChunk(std::string file, int index, bool restart) {
 		this->restart = restart;
 		this->file = std::string(file);
 		this->index = index;
+		this->address = -1;
 	}
 };
 
@@ -44,17 +57,36 @@ public:
 	CData* ioctl_dout;
 	CData* ioctl_din;
 
+	// Fast load: when set, queued images are copied straight into ram
+	// instead of streamed one byte per clock through ioctl
+	CData* ram;
+	int ram_size;
+	bool fast_load;
+
 	void BeforeEval(void);
 	void AfterEval(void);
 	void QueueDownload(std::string file, int index);
 	void QueueDownload(std::string file, int index, bool restart);
+	void QueueDownload(SimBus_Image image, std::string name, int index, bool restart);
+	bool QueueST2(std::string file);
 	bool HasQueue();
 
+	// Download progress, including queued and in-flight images
+	void SaveState(VerilatedSerialize& os);
+	void LoadState(VerilatedDeserialize& os);
+
 	SimBus(DebugConsole c);
 	~SimBus();
 
 private:
 	std::queue<SimBus_DownloadChunk> downloadQueue;
 	SimBus_DownloadChunk currentDownload;
+	SimBus_Image ioctl_image;	// Download in progress
+	size_t ioctl_pos;		// Next byte of ioctl_image to send
+	int ioctl_next_addr;
+	int ioctl_last_index;
+	int fast_load_reset;		// Clocks left to hold the core in reset after a fast load
 	void SetDownload(std::string file, int index);
+	bool NextDownload();
+	void FastLoad();
 };
@@ -0,0 +1,262 @@
+#include "sim_cdp1802.h"
+#include <stdio.h>
+
+SimCDP1802::SimCDP1802() {
+	bus = NULL;
+	Reset();
+	for (int r = 0; r < 16; r++) { R[r] = 0; }
+	D = 0;
+	DF = false;
+	T = 0;
+}
+
+// CLEAR: I, N, P, X, Q and R0 cleared, interrupts enabled. D, DF, T and the
+// other registers keep whatever they held.
+void SimCDP1802::Reset() {
+	I = 0;
+	N = 0;
+	P = 0;
+	X = 0;
+	Q = false;
+	IE = true;
+	idle = false;
+	R[0] = 0;
+	cycles = 0;
+}
+
+// Short branch / long branch condition for the low three bits of N, before
+// the N[3] inversion: always, Q, D == 0, DF, then EF1-EF4
+bool SimCDP1802::Condition(int n) {
+	switch (n & 7) {
+	case 0: return true;
+	case 1: return Q;
+	case 2: return D == 0;
+	case 3: return DF;
+	default: return (bus->Flags() >> (n & 3)) & 1;
+	}
+}
+
+int SimCDP1802::Step() {
+	if (idle) {
+		cycles++;
+		return 1;
+	}
+
+	uint8_t opcode = bus->Read(R[P]++);
+	I = opcode >> 4;
+	N = opcode & 0x0F;
+	uint16_t& RN = R[N];
+	uint16_t& RX = R[X];
+	int cost = 2;
+	int value;
+
+	switch (I) {
+	case 0x0:
+		if (N == 0) { idle = true; }		// IDL
+		else { D = bus->Read(RN); }		// LDN
+		break;
+	case 0x1: RN++; break;				// INC
+	case 0x2: RN--; break;				// DEC
+	case 0x3:					// Short branches
+		if (Condition(N) != ((N & 8) != 0)) { R[P] = (R[P] & 0xFF00) | bus->Read(R[P]); }
+		else { R[P]++; }
+		break;
+	case 0x4: D = bus->Read(RN++); break;		// LDA
+	case 0x5: bus->Write(RN, D); break;		// STR
+	case 0x6:
+		if (N == 0) { RX++; }			// IRX
+		else if (N < 8) {			// OUT
+			value = bus->Read(RX++);
+			bus->Output(N, (uint8_t)value);
+		}
+		else {					// INP (68 as port 0)
+			D = bus->Input(N & 7);
+			bus->Write(RX, D);
+		}
+		break;
+	case 0x7:
+		switch (N) {
+		case 0x0:				// RET
+		case 0x1:				// DIS
+			value = bus->Read(RX++);
+			X = value >> 4;
+			P = value & 0x0F;
+			IE = (N == 0);
+			break;
+		case 0x2: D = bus->Read(RX++); break;	// LDXA
+		case 0x3: bus->Write(RX--, D); break;	// STXD
+		case 0x4:				// ADC
+		case 0xC:				// ADCI
+			value = D + bus->Read(N == 0x4 ? RX : R[P]++) + DF;
+			DF = value > 0xFF;
+			D = (uint8_t)value;
+			break;
+		case 0x5:				// SDB
+		case 0xD:				// SDBI
+			value = bus->Read(N == 0x5 ? RX : R[P]++) + (uint8_t)~D + DF;
+			DF = value > 0xFF;
+			D = (uint8_t)value;
+			break;
+		case 0x6:				// SHRC
+			value = D & 1;
+			D = (D >> 1) | (DF ? 0x80 : 0);
+			DF = value != 0;
+			break;
+		case 0x7:				// SMB
+		case 0xF:				// SMBI
+			value = D + (uint8_t)~bus->Read(N == 0x7 ? RX : R[P]++) + DF;
+			DF = value > 0xFF;
+			D = (uint8_t)value;
+			break;
+		case 0x8: bus->Write(RX, T); break;	// SAV
+		case 0x9:				// MARK
+			T = (X << 4) | P;
+			bus->Write(R[2], T);
+			X = P;
+			R[2]--;
+			break;
+		case 0xA: Q = false; break;		// REQ
+		case 0xB: Q = true; break;		// SEQ
+		case 0xE:				// SHLC
+			value = D >> 7;
+			D = (D << 1) | (DF ? 1 : 0);
+			DF = value != 0;
+			break;
+		}
+		break;
+	case 0x8: D = RN & 0xFF; break;			// GLO
+	case 0x9: D = RN >> 8; break;			// GHI
+	case 0xA: RN = (RN & 0xFF00) | D; break;	// PLO
+	case 0xB: RN = (RN & 0x00FF) | (D << 8); break;	// PHI
+	case 0xC:					// Long branches and skips
+		cost = 3;
+		if (N & 4) {
+			bool skip;
+			switch (N & 3) {
+			case 0: skip = (N & 8) && IE; break;	// NOP, LSIE
+			case 1: skip = Q == ((N & 8) != 0); break;	// LSNQ, LSQ
+			case 2: skip = (D == 0) == ((N & 8) != 0); break;	// LSNZ, LSZ
+			default: skip = DF == ((N & 8) != 0); break;	// LSNF, LSDF
+			}
+			if (skip) { R[P] += 2; }
+		}
+		else if (Condition(N) != ((N & 8) != 0)) {
+			value = bus->Read(R[P]) << 8;
+			value |= bus->Read(R[P] + 1);
+			R[P] = (uint16_t)value;
+		}
+		else { R[P] += 2; }
+		break;
+	case 0xD: P = N; break;				// SEP
+	case 0xE: X = N; break;				// SEX
+	case 0xF:
+		if (N == 0x0) {				// LDX
+			D = bus->Read(RX);
+			break;
+		}
+		if (N == 0x8) {				// LDI
+			D = bus->Read(R[P]++);
+			break;
+		}
+		if (N == 0x6) {				// SHR
+			DF = D & 1;
+			D >>= 1;
+			break;
+		}
+		if (N == 0xE) {				// SHL
+			DF = D >> 7;
+			D <<= 1;
+			break;
+		}
+		value = bus->Read(N & 8 ? R[P]++ : RX);
+		switch (N & 7) {
+		case 1: D |= value; break;		// OR, ORI
+		case 2: D &= value; break;		// AND, ANI
+		case 3: D ^= value; break;		// XOR, XRI
+		case 4:					// ADD, ADI
+			value += D;
+			DF = value > 0xFF;
+			D = (uint8_t)value;
+			break;
+		case 5:					// SD, SDI
+			value += (uint8_t)~D + 1;
+			DF = value > 0xFF;
+			D = (uint8_t)value;
+			break;
+		case 7:					// SM, SMI
+			value = D + (uint8_t)~value + 1;
+			DF = value > 0xFF;
+			D = (uint8_t)value;
+			break;
+		}
+		break;
+	}
+	cycles += cost;
+	return cost;
+}
+
+void SimCDP1802::Interrupt() {
+	T = (X << 4) | P;
+	X = 2;
+	P = 1;
+	IE = false;
+	idle = false;
+	cycles++;
+}
+
+uint8_t SimCDP1802::DmaOut() {
+	uint8_t value = bus->Read(R[0]++);
+	idle = false;
+	cycles++;
+	return value;
+}
+
+void SimCDP1802::DmaIn(uint8_t value) {
+	bus->Write(R[0]++, value);
+	idle = false;
+	cycles++;
+}
+
+// Mnemonics
+// ---------
+
+static const char* mnemonics_3[16] = {
+	"BR", "BQ", "BZ", "BDF", "B1", "B2", "B3", "B4",
+	"SKP", "BNQ", "BNZ", "BNF", "BN1", "BN2", "BN3", "BN4"
+};
+static const char* mnemonics_6[16] = {
+	"IRX", "OUT 1", "OUT 2", "OUT 3", "OUT 4", "OUT 5", "OUT 6", "OUT 7",
+	"INP 0", "INP 1", "INP 2", "INP 3", "INP 4", "INP 5", "INP 6", "INP 7"
+};
+static const char* mnemonics_7[16] = {
+	"RET", "DIS", "LDXA", "STXD", "ADC", "SDB", "SHRC", "SMB",
+	"SAV", "MARK", "REQ", "SEQ", "ADCI", "SDBI", "SHLC", "SMBI"
+};
+static const char* mnemonics_C[16] = {
+	"LBR", "LBQ", "LBZ", "LBDF", "NOP", "LSNQ", "LSNZ", "LSNF",
+	"LSKP", "LBNQ", "LBNZ", "LBNF", "LSIE", "LSQ", "LSZ", "LSDF"
+};
+static const char* mnemonics_F[16] = {
+	"LDX", "OR", "AND", "XOR", "ADD", "SD", "SHR", "SM",
+	"LDI", "ORI", "ANI", "XRI", "ADI", "SDI", "SHL", "SMI"
+};
+static const char* mnemonics_N[16] = {
+	"LDN", "INC", "DEC", NULL, "LDA", "STR", NULL, NULL,
+	"GLO", "GHI", "PLO", "PHI", NULL, "SEP", "SEX", NULL
+};
+
+const char* SimCDP1802_Mnemonic(uint8_t opcode) {
+	static char text[16];
+	int i = opcode >> 4;
+	int n = opcode & 0x0F;
+	switch (i) {
+	case 0x3: return mnemonics_3[n];
+	case 0x6: return mnemonics_6[n];
+	case 0x7: return mnemonics_7[n];
+	case 0xC: return mnemonics_C[n];
+	case 0xF: return mnemonics_F[n];
+	}
+	if (opcode == 0x00) { return "IDL"; }
+	snprintf(text, sizeof(text), "%s R%X", mnemonics_N[i], n);
+	return text;
+}
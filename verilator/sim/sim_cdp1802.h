@@ -0,0 +1,56 @@
+#pragma once
+#include <stdint.h>
+
+// CDP1802 instruction-level model
+// -------------------------------
+// Executes one whole instruction per Step() with the architectural effects
+// of the RCA datasheet, including RET/DIS/SAV/MARK, the long skips, IDL,
+// interrupts and DMA. Memory, I/O and the EF flags go through a
+// SimCDP1802_Bus so the same core can be fed from the Verilated bus (lockstep
+// co-simulation) or from plain memory.
+//
+// EF flags are passed as "flag true" bits, EF1 in bit 0, the same sense as
+// the EF vector of the RTL core (B1 branches when bit 0 is set).
+
+struct SimCDP1802_Bus {
+	virtual ~SimCDP1802_Bus() {}
+	virtual uint8_t Read(uint16_t address) = 0;
+	virtual void Write(uint16_t address, uint8_t value) = 0;
+	virtual uint8_t Input(int port) = 0;			// INP, port 1-7 (0 for 68)
+	virtual void Output(int port, uint8_t value) = 0;	// OUT, port 1-7
+	virtual uint8_t Flags() = 0;				// EF1-EF4 in bits 0-3
+};
+
+struct SimCDP1802 {
+public:
+	uint16_t R[16];
+	uint8_t P;
+	uint8_t X;
+	uint8_t D;
+	uint8_t T;
+	uint8_t I;	// Last opcode, high nibble
+	uint8_t N;	// Last opcode, low nibble
+	bool DF;
+	bool Q;
+	bool IE;
+	bool idle;	// Stopped by IDL until the next DMA or interrupt
+	uint64_t cycles;	// Machine cycles (8 clocks each) since Reset()
+
+	SimCDP1802_Bus* bus;
+
+	SimCDP1802();
+	void Reset();
+
+	// One instruction (or one idle cycle), returns its machine cycles
+	int Step();
+	// S3 interrupt cycle and S2 DMA cycles
+	void Interrupt();
+	uint8_t DmaOut();
+	void DmaIn(uint8_t value);
+
+private:
+	bool Condition(int n);
+};
+
+// Mnemonic of an opcode, for reports
+const char* SimCDP1802_Mnemonic(uint8_t opcode);
@@ -1,5 +1,6 @@
 #include "sim_clock.h"
 #include <string>
+#include "verilated_save.h"
 
 SimClock::SimClock() {
 	ratio = 1;
@@ -37,3 +38,13 @@ void SimClock::Reset() {
 bool SimClock::IsRising() {
 	return clk && !old;
 }
+
+void SimClock::SaveState(VerilatedSerialize& os) {
+	os << clk << old;
+	os.write(&count, sizeof(count));
+}
+
+void SimClock::LoadState(VerilatedDeserialize& os) {
+	os >> clk >> old;
+	os.read(&count, sizeof(count));
+}
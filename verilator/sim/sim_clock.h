@@ -1,5 +1,8 @@
 #pragma once
 
+class VerilatedSerialize;
+class VerilatedDeserialize;
+
 class SimClock
 {
 
@@ -12,6 +15,8 @@ public:
 	void Tick();
 	void Reset();
 	bool IsRising();
+	void SaveState(VerilatedSerialize& os);
+	void LoadState(VerilatedDeserialize& os);
 
 private:
 	int ratio, count;
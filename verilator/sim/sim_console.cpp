@@ -1,7 +1,81 @@
 #include "sim_console.h"
 #include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
 #include "imgui.h"
+#include "sim_logring.h"
+
+// Rate limiting
+// -------------
+// Each AddLog() call site, keyed by its format string pointer (or the site
+// passed to AddLogSite()), may log log_rate_lines per second. Lines over that are dropped and counted, and
+// the count is reported by the first line from that site in a new window.
+const int log_rate_lines = 200;
+const int log_rate_sites = 256;
+
+struct LogRateSite {
+	const void* site;
+	int64_t window;
+	int count;
+	int suppressed;
+};
+static LogRateSite log_sites[log_rate_sites];
+static std::mutex log_sites_mutex;
+
+// Returns false if the line should be dropped. suppressed is set to the
+// number of lines dropped in the previous window when a new one starts.
+static bool logRateCheck(const void* key, int& suppressed) {
+	suppressed = 0;
+	int64_t now = std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	std::lock_guard<std::mutex> lock(log_sites_mutex);
+	size_t hash = ((uintptr_t)key >> 3) * 2654435761u;
+	for (int probe = 0; probe < log_rate_sites; probe++) {
+		LogRateSite& site = log_sites[(hash + probe) % log_rate_sites];
+		if (site.site != key && site.site != NULL) { continue; }
+		if (site.site == NULL) { site.site = key; site.window = now; }
+		if (site.window != now) {
+			suppressed = site.suppressed;
+			site.window = now;
+			site.count = 0;
+			site.suppressed = 0;
+		}
+		if (site.count >= log_rate_lines) {
+			site.suppressed++;
+			return false;
+		}
+		site.count++;
+		return true;
+	}
+	return true;	// Table full, no limit
+}
+
+#ifdef SIM_HEADLESS
+// No log window when headless, lines go straight to stdout
+static void logLine(const void* key, const char* fmt, va_list args)
+{
+	int suppressed;
+	if (!logRateCheck(key, suppressed)) { return; }
+	if (suppressed) { printf("[%d similar lines suppressed]\n", suppressed); }
+	vprintf(fmt, args);
+	printf("\n");
+}
 
+DebugConsole::DebugConsole()
+{
+}
+
+DebugConsole::~DebugConsole()
+{
+}
+
+void DebugConsole::ClearLog()
+{
+}
+#else
 // Demonstrate creating a simple console window, with scrolling, filtering, completion and history.
 // For the console example, here we are using a more C++ like approach of declaring a class to hold the data and the functions.
 
@@ -14,19 +88,44 @@ bool                  AutoScroll;
 bool                  ScrollToBottom;
 
 
-ImVector<char*>       Items;
+// Log storage
+// -----------
+// A SimLogRing of log_max_lines lines in a 1 MB arena, see sim_logring.h.
+// Lines are numbered so the filtered view can refer to them across evictions.
+const int log_max_lines = 16384;
+const int log_arena_size = 1 << 20;
+const int log_max_length = 1024;
+
+static SimLogRing<log_max_lines, log_arena_size, log_max_length> log_ring;
+std::mutex ItemsMutex;	// AddLog() is called from the sim thread while Draw() runs on the GUI thread
+
+// Filtered view, line numbers that passed Filter (GUI thread only)
+static ImVector<uint64_t> log_filtered;
+static uint64_t log_filtered_next = 0;	// First line number not yet tested
+static bool log_filter_dirty = true;
+
+// Lines copied out under ItemsMutex for drawing, so AddLog() never waits on
+// ImGui. log_view_starts holds the offset of each line in log_view_text.
+static std::vector<char> log_view_text;
+static std::vector<int> log_view_starts;
+
 static char* Strdup(const char* str) { size_t len = strlen(str) + 1; void* buf = malloc(len); IM_ASSERT(buf); return (char*)memcpy(buf, (const void*)str, len); }
 
-void DebugConsole::AddLog(const char* fmt, ...) IM_FMTARGS(2)
+static void logLine(const void* key, const char* fmt, va_list args)
 {
-	// FIXME-OPT
-	char buf[1024];
-	va_list args;
-	va_start(args, fmt);
-	vsnprintf(buf, IM_ARRAYSIZE(buf), fmt, args);
-	buf[IM_ARRAYSIZE(buf) - 1] = 0;
-	va_end(args);
-	Items.push_back(Strdup(buf));
+	int suppressed;
+	if (!logRateCheck(key, suppressed)) { return; }
+	char buf[log_max_length];
+	int length = vsnprintf(buf, IM_ARRAYSIZE(buf), fmt, args);
+	if (length < 0) { return; }
+	if (length > IM_ARRAYSIZE(buf) - 1) { length = IM_ARRAYSIZE(buf) - 1; }
+	std::lock_guard<std::mutex> lock(ItemsMutex);
+	if (suppressed) {
+		char note[64];
+		int noteLength = snprintf(note, sizeof(note), "[%d similar lines suppressed]", suppressed);
+		log_ring.Append(note, noteLength);
+	}
+	log_ring.Append(buf, length);
 }
 
 DebugConsole::DebugConsole()
@@ -57,9 +156,9 @@ static void  Strtrim(char* str) { char* str_end = str + strlen(str); while (str_
 
 void DebugConsole::ClearLog()
 {
-	for (int i = 0; i < Items.Size; i++)
-		free(Items[i]);
-	Items.clear();
+	std::lock_guard<std::mutex> lock(ItemsMutex);
+	log_ring.Clear();
+	log_filter_dirty = true;
 }
 
 void DebugConsole::Draw(const char* title, bool* p_open, ImVec2 size)
@@ -100,7 +199,8 @@ void DebugConsole::Draw(const char* title, bool* p_open, ImVec2 size)
 	if (ImGui::Button("Options"))
 		ImGui::OpenPopup("Options");
 	ImGui::SameLine();
-	Filter.Draw("Filter (\"incl,-excl\") (\"error\")", 180);
+	if (Filter.Draw("Filter (\"incl,-excl\") (\"error\")", 180))
+		log_filter_dirty = true;
 	ImGui::Separator();
 
 	const float footer_height_to_reserve = ImGui::GetStyle().ItemSpacing.y + ImGui::GetFrameHeightWithSpacing(); // 1 separator, 1 input text
@@ -111,33 +211,81 @@ void DebugConsole::Draw(const char* title, bool* p_open, ImVec2 size)
 		ImGui::EndPopup();
 	}
 
-	// Display every line as a separate entry so we can change their color or add custom widgets. If you only want raw text you can use ImGui::TextUnformatted(log.begin(), log.end());
-	// NB- if you have thousands of entries this approach may be too inefficient and may require user-side clipping to only process visible items.
-	// You can seek and display only the lines that are visible using the ImGuiListClipper helper, if your elements are evenly spaced and you have cheap random access to the elements.
-	// To use the clipper we could replace the 'for (int i = 0; i < Items.Size; i++)' loop with:
-	//     ImGuiListClipper clipper(Items.Size);
-	//     while (clipper.Step())
-	//         for (int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++)
-	// However, note that you can not use this code as is if a filter is active because it breaks the 'cheap random-access' property. We would need random-access on the post-filtered list.
-	// A typical application wanting coarse clipping and filtering may want to pre-compute an array of indices that passed the filtering test, recomputing this array when user changes the filter,
-	// and appending newly elements as they are inserted. This is left as a task to the user until we can manage to improve this example code!
-	// If your items are of variable size you may want to implement code similar to what ImGuiListClipper does. Or split your data into fixed height items to allow random-seeking into your list.
+	// Only the visible lines are submitted (ImGuiListClipper). With a filter
+	// active the clipper runs over log_filtered, which is brought up to date
+	// incrementally as lines arrive and rebuilt when the filter changes.
+	// ItemsMutex is only held to update that list and to copy out the lines
+	// of each clipper step, never while ImGui draws them. Copy takes every
+	// line so the clipboard gets the whole log.
 	ImGui::PushStyleVar(ImGuiStyleVar_ItemSpacing, ImVec2(4, 1)); // Tighten spacing
 	if (copy_to_clipboard)
 		ImGui::LogToClipboard();
-	for (int i = 0; i < Items.Size; i++)
+	bool filtering = Filter.IsActive();
+	int count;
 	{
-		const char* item = Items[i];
-		if (!Filter.PassFilter(item))
-			continue;
-
-		// Normally you would store more information in your item (e.g. make Items[] an array of structure, store color/type etc.)
-		bool pop_color = false;
-		if (strstr(item, "[error]")) { ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.4f, 0.4f, 1.0f)); pop_color = true; }
-		else if (strncmp(item, "# ", 2) == 0) { ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.8f, 0.6f, 1.0f)); pop_color = true; }
-		ImGui::TextUnformatted(item);
-		if (pop_color)
-			ImGui::PopStyleColor();
+		std::lock_guard<std::mutex> lock(ItemsMutex);
+		if (filtering) {
+			if (log_filter_dirty) {
+				log_filtered.clear();
+				log_filtered_next = log_ring.First();
+				log_filter_dirty = false;
+			}
+			if (log_filtered_next < log_ring.First()) { log_filtered_next = log_ring.First(); }
+			for (; log_filtered_next < log_ring.total; log_filtered_next++) {
+				if (Filter.PassFilter(log_ring.Text(log_filtered_next))) { log_filtered.push_back(log_filtered_next); }
+			}
+			// Drop evicted lines from the front
+			int evicted = 0;
+			while (evicted < log_filtered.Size && log_filtered[evicted] < log_ring.First()) { evicted++; }
+			if (evicted > 0) { log_filtered.erase(log_filtered.begin(), log_filtered.begin() + evicted); }
+		}
+		else {
+			log_filter_dirty = true;
+		}
+		count = filtering ? log_filtered.Size : log_ring.count;
+	}
+	// Copy lines [start, end) of the view, lines evicted since come out empty
+	auto copyLines = [filtering](int start, int end) {
+		log_view_text.clear();
+		log_view_starts.clear();
+		std::lock_guard<std::mutex> lock(ItemsMutex);
+		uint64_t first = log_ring.First();
+		for (int i = start; i < end; i++) {
+			uint64_t number = filtering ? log_filtered[i] : first + i;
+			log_view_starts.push_back((int)log_view_text.size());
+			if (number >= first && number < log_ring.total) {
+				const char* text = log_ring.Text(number);
+				log_view_text.insert(log_view_text.end(), text, text + log_ring.Get(number).length);
+			}
+			log_view_text.push_back(0);
+		}
+	};
+	auto drawLines = [](int lines) {
+		for (int i = 0; i < lines; i++) {
+			const char* item = &log_view_text[log_view_starts[i]];
+
+			bool pop_color = false;
+			if (strstr(item, "[error]")) { ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.4f, 0.4f, 1.0f)); pop_color = true; }
+			else if (strncmp(item, "# ", 2) == 0) { ImGui::PushStyleColor(ImGuiCol_Text, ImVec4(1.0f, 0.8f, 0.6f, 1.0f)); pop_color = true; }
+			ImGui::TextUnformatted(item);
+			if (pop_color)
+				ImGui::PopStyleColor();
+		}
+	};
+	if (copy_to_clipboard)
+	{
+		copyLines(0, count);
+		drawLines(count);
+	}
+	else
+	{
+		ImGuiListClipper clipper;
+		clipper.Begin(count);
+		while (clipper.Step())
+		{
+			copyLines(clipper.DisplayStart, clipper.DisplayEnd);
+			drawLines(clipper.DisplayEnd - clipper.DisplayStart);
+		}
 	}
 	if (copy_to_clipboard)
 		ImGui::LogFinish();
@@ -311,3 +459,20 @@ int     DebugConsole::TextEditCallback(ImGuiInputTextCallbackData* data)
 	}
 	return 0;
 };
+#endif
+
+void DebugConsole::AddLog(const char* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	logLine(fmt, fmt, args);
+	va_end(args);
+}
+
+void DebugConsole::AddLogSite(const void* site, const char* fmt, ...)
+{
+	va_list args;
+	va_start(args, fmt);
+	logLine(site, fmt, args);
+	va_end(args);
+}
@@ -4,6 +4,8 @@
 struct DebugConsole {
 public:
 	void AddLog(const char* fmt, ...) IM_FMTARGS(2);
+	// Rate limited by site instead of fmt, for callers that share one format
+	void AddLogSite(const void* site, const char* fmt, ...) IM_FMTARGS(3);
 	DebugConsole();
 	~DebugConsole();
 	void ClearLog();
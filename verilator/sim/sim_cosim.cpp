@@ -0,0 +1,264 @@
+#include "sim_cosim.h"
+#include <stdio.h>
+
+// cdp1802.v states
+static const int rtl_fetch = 1;
+static const int rtl_execute = 2;
+
+SimCosim::SimCosim(DebugConsole& c) {
+	console = &c;
+	state = NULL;
+	clear_n = NULL;
+	ram_a = NULL;
+	ram_rd = NULL;
+	ram_wr = NULL;
+	ram_d = NULL;
+	ram_q = NULL;
+	ef = NULL;
+	int_n = NULL;
+	dma_out_req = NULL;
+	io_din = NULL;
+	io_dout = NULL;
+	io_n = NULL;
+	io_out = NULL;
+	R = NULL;
+	P = NULL;
+	X = NULL;
+	D = NULL;
+	DF = NULL;
+	Q = NULL;
+
+	enabled = true;
+	check_requests = false;
+	diverged = false;
+	instructions = 0;
+	model.bus = this;
+
+	synced = false;
+	in_instruction = false;
+	read_pending = false;
+	read_address = 0;
+	read_pos = 0;
+	write_pos = 0;
+	output_pos = 0;
+	execute_ef = 0;
+	execute_din = 0;
+	request_int = false;
+	request_dma = false;
+	warned_int = false;
+	warned_dma = false;
+	history_pos = 0;
+	for (int i = 0; i < history_size; i++) { history[i] = { 0, 0, 0 }; }
+}
+
+void SimCosim::Resync() {
+	synced = false;
+	in_instruction = false;
+	read_pending = false;
+}
+
+void SimCosim::CopyFromRTL() {
+	for (int r = 0; r < 16; r++) { model.R[r] = R[r]; }
+	model.P = *P;
+	model.X = *X;
+	model.D = *D;
+	model.DF = *DF;
+	model.Q = *Q;
+	model.idle = false;
+}
+
+// Bus capture
+// -----------
+
+void SimCosim::Clock(vluint64_t time) {
+	if (!enabled || diverged) { return; }
+	if (!*clear_n) {
+		model.Reset();
+		Resync();
+		return;
+	}
+
+	// Data for the read latched at this edge
+	if (read_pending) {
+		reads.push_back({ read_address, *ram_q });
+		read_pending = false;
+	}
+
+	// Instruction boundary: check the one just finished, start the next
+	if (*state == rtl_fetch) {
+		if (!synced) {
+			CopyFromRTL();
+			synced = true;
+		}
+		else if (in_instruction) {
+			Check(time);
+			if (diverged) { return; }
+			if (check_requests && (request_dma || (request_int && model.IE))) {
+				const SimCosim_Trace& last = history[(history_pos + history_size - 1) % history_size];
+				Report(time, last.pc, last.opcode, request_dma ? "DMA OUT request not served, RTL fetched instead" :
+					"interrupt request with IE set not served, RTL fetched instead");
+				return;
+			}
+			if (request_dma && !warned_dma) {
+				console->AddLog("Co-simulation warning at main_time %llu: DMA OUT request not served, further ones not reported", (unsigned long long)time);
+				warned_dma = true;
+			}
+			if (request_int && model.IE && !warned_int) {
+				console->AddLog("Co-simulation warning at main_time %llu: interrupt request with IE set not served, further ones not reported", (unsigned long long)time);
+				warned_int = true;
+			}
+		}
+		reads.clear();
+		writes.clear();
+		outputs.clear();
+		in_instruction = true;
+	}
+
+	if (*ram_rd) {
+		read_pending = true;
+		read_address = *ram_a;
+	}
+	if (*ram_wr) { writes.push_back({ *ram_a, *ram_d }); }
+	if (*io_out) { outputs.push_back({ *io_n, *io_dout }); }
+	if (*state == rtl_execute) {
+		execute_ef = *ef;
+		execute_din = *io_din;
+	}
+	// Both request pins are active low (INT_N, DMA OUT from the 1861)
+	request_int = !*int_n;
+	request_dma = !*dma_out_req;
+}
+
+// Model bus
+// ---------
+
+uint8_t SimCosim::Read(uint16_t address) {
+	for (size_t i = read_pos; i < reads.size(); i++) {
+		if (reads[i].address == address) {
+			read_pos = i + 1;
+			return reads[i].value;
+		}
+	}
+	if (bus_error.empty()) {
+		char text[64];
+		snprintf(text, sizeof(text), "model read %04X not on the RTL bus", address);
+		bus_error = text;
+	}
+	return 0;
+}
+
+void SimCosim::Write(uint16_t address, uint8_t value) {
+	char text[64];
+	if (write_pos >= writes.size()) {
+		snprintf(text, sizeof(text), "model wrote %04X=%02X, RTL did not write", address, value);
+	}
+	else if (writes[write_pos].address != address || writes[write_pos].value != value) {
+		snprintf(text, sizeof(text), "model wrote %04X=%02X, RTL wrote %04X=%02X", address, value,
+			writes[write_pos].address, writes[write_pos].value);
+	}
+	else {
+		write_pos++;
+		return;
+	}
+	write_pos++;
+	if (bus_error.empty()) { bus_error = text; }
+}
+
+uint8_t SimCosim::Input(int port) {
+	return execute_din;
+}
+
+void SimCosim::Output(int port, uint8_t value) {
+	char text[64];
+	if (output_pos >= outputs.size()) {
+		snprintf(text, sizeof(text), "model OUT %d=%02X, RTL did not output", port, value);
+	}
+	else if (outputs[output_pos].address != port || outputs[output_pos].value != value) {
+		snprintf(text, sizeof(text), "model OUT %d=%02X, RTL OUT %d=%02X", port, value,
+			outputs[output_pos].address, outputs[output_pos].value);
+	}
+	else {
+		output_pos++;
+		return;
+	}
+	output_pos++;
+	if (bus_error.empty()) { bus_error = text; }
+}
+
+uint8_t SimCosim::Flags() {
+	return execute_ef;
+}
+
+// Comparison
+// ----------
+
+void SimCosim::Check(vluint64_t time) {
+	uint16_t pc = model.R[model.P];
+	read_pos = 0;
+	write_pos = 0;
+	output_pos = 0;
+	bus_error.clear();
+	model.Step();
+	uint8_t opcode = (model.I << 4) | model.N;
+	instructions++;
+
+	history[history_pos] = { pc, opcode, time };
+	history_pos = (history_pos + 1) % history_size;
+
+	if (bus_error.empty() && write_pos < writes.size()) {
+		char text[64];
+		snprintf(text, sizeof(text), "RTL wrote %04X=%02X, model did not write", writes[write_pos].address, writes[write_pos].value);
+		bus_error = text;
+	}
+	if (bus_error.empty() && output_pos < outputs.size()) {
+		char text[64];
+		snprintf(text, sizeof(text), "RTL OUT %d=%02X, model did not output", outputs[output_pos].address, outputs[output_pos].value);
+		bus_error = text;
+	}
+	if (!bus_error.empty()) {
+		Report(time, pc, opcode, bus_error.c_str());
+		return;
+	}
+
+	bool same = model.P == *P && model.X == *X && model.D == *D && model.DF == (*DF != 0) && model.Q == (*Q != 0);
+	for (int r = 0; r < 16; r++) { same = same && model.R[r] == R[r]; }
+	if (!same) { Report(time, pc, opcode, "register mismatch"); }
+}
+
+void SimCosim::Report(vluint64_t time, uint16_t pc, uint8_t opcode, const char* reason) {
+	diverged = true;
+	console->AddLog("Co-simulation divergence at main_time %llu after %llu instructions: %s", (unsigned long long)time,
+		(unsigned long long)instructions, reason);
+	console->AddLog("  instruction %04X: %02X %s", pc, opcode, SimCDP1802_Mnemonic(opcode));
+	console->AddLog("        model RTL");
+	console->AddLog("  P     %X     %X%s", model.P, *P, model.P != *P ? "  *" : "");
+	console->AddLog("  X     %X     %X%s", model.X, *X, model.X != *X ? "  *" : "");
+	console->AddLog("  D     %02X    %02X%s", model.D, *D, model.D != *D ? "  *" : "");
+	console->AddLog("  DF    %d     %d%s", model.DF, *DF, model.DF != (*DF != 0) ? "  *" : "");
+	console->AddLog("  Q     %d     %d%s", model.Q, *Q, model.Q != (*Q != 0) ? "  *" : "");
+	for (int r = 0; r < 16; r++) {
+		console->AddLog("  R%X    %04X  %04X%s", r, model.R[r], R[r], model.R[r] != R[r] ? "  *" : "");
+	}
+
+	// RTL bus activity of the instruction
+	std::string line;
+	char text[32];
+	for (const SimCosim_Access& a : reads) {
+		snprintf(text, sizeof(text), " %04X=%02X", a.address, a.value);
+		line += text;
+	}
+	console->AddLog("  RTL reads: %s", line.empty() ? " -" : line.c_str());
+	line.clear();
+	for (const SimCosim_Access& a : writes) {
+		snprintf(text, sizeof(text), " %04X=%02X", a.address, a.value);
+		line += text;
+	}
+	console->AddLog("  RTL writes:%s", line.empty() ? " -" : line.c_str());
+
+	console->AddLog("  Last instructions:");
+	for (int i = 0; i < history_size; i++) {
+		const SimCosim_Trace& h = history[(history_pos + i) % history_size];
+		if (h.time == 0) { continue; }
+		console->AddLog("    %llu  %04X: %02X %s", (unsigned long long)h.time, h.pc, h.opcode, SimCDP1802_Mnemonic(h.opcode));
+	}
+}
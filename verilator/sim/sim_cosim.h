@@ -0,0 +1,112 @@
+#pragma once
+#include "verilated_heavy.h"
+#include "sim_console.h"
+#include "sim_cdp1802.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Lockstep co-simulation
+// ----------------------
+// Runs SimCDP1802 next to the Verilated cdp1802. Clock() watches the RTL
+// once per clk_sys cycle and records its bus: reads (paired with ram_q one
+// cycle later, the DPRAM is synchronous), writes, OUT data, and the EF and
+// io_din values it sampled in EXECUTE. When the RTL reaches the next FETCH,
+// the model runs the finished instruction from those recorded values: every
+// model read must appear on the RTL bus at the same address (the RTL may do
+// extra dummy reads), and writes and outputs must match one for one. Then
+// P, X, D, DF, Q and R0-RF are compared. The first mismatch stops the check
+// and logs a report with the bus activity and the last instructions.
+//
+// A real 1802 serves DMA OUT and (with IE set) interrupt requests between
+// instructions. cdp1802.v does not serve either yet, and the Pixie raises
+// both every frame, so by default the first unserved request of each kind
+// is logged as a warning and the register check carries on. check_requests
+// reports an RTL that fetches instead as a divergence.
+
+struct SimCosim_Access {
+	uint16_t address;
+	uint8_t value;
+};
+
+struct SimCosim_Trace {
+	uint16_t pc;
+	uint8_t opcode;
+	vluint64_t time;
+};
+
+struct SimCosim : public SimCDP1802_Bus {
+public:
+	// RTL signals, set up in initialiseSim()
+	const CData* state;
+	const CData* clear_n;
+	const SData* ram_a;
+	const CData* ram_rd;
+	const CData* ram_wr;
+	const CData* ram_d;
+	const CData* ram_q;
+	const CData* ef;
+	const CData* int_n;
+	const CData* dma_out_req;
+	const CData* io_din;
+	const CData* io_dout;
+	const CData* io_n;
+	const CData* io_out;
+	const SData* R;
+	const CData* P;
+	const CData* X;
+	const CData* D;
+	const CData* DF;
+	const CData* Q;
+
+	bool enabled;
+	bool check_requests;
+	SimCDP1802 model;
+	std::atomic<bool> diverged;
+	vluint64_t instructions;
+
+	SimCosim(DebugConsole& c);
+
+	// Called once per clk_sys cycle after eval
+	void Clock(vluint64_t time);
+	// Take the model state from the RTL again (after reset or a state load)
+	void Resync();
+
+	// SimCDP1802_Bus, served from the recorded RTL bus
+	virtual uint8_t Read(uint16_t address) override;
+	virtual void Write(uint16_t address, uint8_t value) override;
+	virtual uint8_t Input(int port) override;
+	virtual void Output(int port, uint8_t value) override;
+	virtual uint8_t Flags() override;
+
+private:
+	DebugConsole* console;
+	bool synced;
+	bool in_instruction;
+	bool read_pending;
+	uint16_t read_address;
+
+	// Bus activity of the instruction in progress
+	std::vector<SimCosim_Access> reads;
+	std::vector<SimCosim_Access> writes;
+	std::vector<SimCosim_Access> outputs;
+	size_t read_pos;
+	size_t write_pos;
+	size_t output_pos;
+	uint8_t execute_ef;
+	uint8_t execute_din;
+	bool request_int;
+	bool request_dma;
+	bool warned_int;
+	bool warned_dma;
+	std::string bus_error;
+
+	// Last instructions, for the report
+	static const int history_size = 16;
+	SimCosim_Trace history[history_size];
+	int history_pos;
+
+	void CopyFromRTL();
+	void Check(vluint64_t time);
+	void Report(vluint64_t time, uint16_t pc, uint8_t opcode, const char* reason);
+};
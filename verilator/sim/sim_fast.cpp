@@ -0,0 +1,328 @@
+#include "sim_fast.h"
+#include <string.h>
+
+// Pixie
+// -----
+// pixie_video_studioii.v, counters and flags only: the pixel pipeline is
+// replaced by Render()
+
+enum { SM_VBLANK, SM_READ_ROW_CACHE, SM_LOAD_BYTE, SM_GENERATE_PIXELS, SM_VIDEO_ROW };
+enum { SMV_LEFT, SMV_START_PIXEL, SMV_END_PIXEL, SMV_END_RIGHT, SMV_END_ROW };
+
+static const int pixels_per_line = 112;
+static const int lines_per_frame = 262;
+static const int vertical_start_line = 64;
+static const int vertical_end_line = 193;
+static const int horizontal_start_pixel = 16;
+static const int horizontal_end_pixel = 80;
+
+// Lines a handoff may happen on: vertical blank, clear of VSync, EFx and INT
+static const int handoff_first_line = 2;
+static const int handoff_last_line = 56;
+
+void SimFast_Pixie::Clock() {
+	// Non-blocking assignments: everything below reads the old values
+	SimFast_Pixie n = *this;
+	int& hpc = horizontal_pixel_counter;
+	int& vpc = vertical_pixel_counter;
+
+	switch (video_state) {
+	case SM_VBLANK:
+		if (vpc == vertical_start_line) { n.video_state = SM_VIDEO_ROW; }
+		else if (vpc == lines_per_frame) {
+			n.vertical_pixel_counter = 1;
+			n.line_repeat_counter = 0;
+		}
+		if (hpc == pixels_per_line) {
+			n.horizontal_pixel_counter = 0;
+			n.vertical_pixel_counter = vpc + 1;
+		}
+		else { n.horizontal_pixel_counter = hpc + 1; }
+		break;
+	case SM_VIDEO_ROW:
+		switch (pixel_state) {
+		case SMV_LEFT:
+			if (hpc == 1 && line_repeat_counter == 0) {
+				n.line_repeat_counter = 4;
+				n.video_state = SM_READ_ROW_CACHE;
+			}
+			if (hpc == horizontal_start_pixel) { n.pixel_state = SMV_START_PIXEL; }
+			else { n.horizontal_pixel_counter = hpc + 1; }
+			break;
+		case SMV_START_PIXEL:
+			n.video_state = SM_LOAD_BYTE;
+			n.pixel_state = SMV_END_PIXEL;
+			n.line_repeat_counter = (line_repeat_counter - 1) & 15;
+			break;
+		case SMV_END_PIXEL:
+			if (hpc == horizontal_end_pixel) { n.pixel_state = SMV_END_RIGHT; }
+			else { n.horizontal_pixel_counter = hpc + 1; }
+			break;
+		case SMV_END_RIGHT:
+			if (hpc == pixels_per_line) { n.pixel_state = SMV_END_ROW; }
+			else { n.horizontal_pixel_counter = hpc + 1; }
+			break;
+		case SMV_END_ROW:
+			if (vpc == vertical_end_line) {
+				n.video_byte_counter = 0;
+				n.video_state = SM_VBLANK;
+			}
+			else { n.vertical_pixel_counter = vpc + 1; }
+			n.horizontal_pixel_counter = 0;
+			n.pixel_state = SMV_LEFT;
+			break;
+		}
+		break;
+	case SM_READ_ROW_CACHE:
+		if (row_cache_counter == 7) {
+			n.row_cache_counter = 0;
+			n.video_byte_counter = (video_byte_counter + 8) & 0xFFFF;
+			n.video_state = SM_VIDEO_ROW;
+		}
+		else { n.row_cache_counter = row_cache_counter + 1; }
+		break;
+	case SM_LOAD_BYTE:
+		n.video_state = SM_GENERATE_PIXELS;
+		break;
+	case SM_GENERATE_PIXELS:
+		n.horizontal_pixel_counter = hpc + 1;
+		if (nbit < 7) { n.nbit = nbit + 1; }
+		else {
+			n.nbit = 0;
+			if (byte_counter == 7) {
+				n.byte_counter = 0;
+				n.video_state = SM_VIDEO_ROW;
+			}
+			else {
+				n.byte_counter = byte_counter + 1;
+				n.video_state = SM_LOAD_BYTE;
+			}
+		}
+		break;
+	}
+	n.horizontal_pixel_counter &= 0xFF;
+	n.vertical_pixel_counter &= 0x1FF;
+
+	n.EFx = (vpc >= vertical_start_line - 4 && vpc <= vertical_start_line) || (vpc >= vertical_end_line - 4 && vpc <= vertical_end_line);
+	n.INT = vpc >= vertical_start_line - 2 && vpc <= vertical_start_line;
+	n.VSync = vpc > 252 && vpc <= 262;
+	n.HSync = hpc > 108 && hpc < 111;
+	n.HBlank = hpc < horizontal_start_pixel || hpc > horizontal_end_pixel;
+	n.VBlank = vpc < vertical_start_line || vpc >= vertical_end_line - 1;
+	*this = n;
+}
+
+bool SimFast_Pixie::SameCounters(const SimFast_Pixie& other) const {
+	return vertical_pixel_counter == other.vertical_pixel_counter && horizontal_pixel_counter == other.horizontal_pixel_counter &&
+		video_state == other.video_state && pixel_state == other.pixel_state && line_repeat_counter == other.line_repeat_counter &&
+		row_cache_counter == other.row_cache_counter && video_byte_counter == other.video_byte_counter &&
+		byte_counter == other.byte_counter && nbit == other.nbit;
+}
+
+// The frame from the first cycle of line 1 (horizontal counter 1, as line
+// 262 wraps one cycle in) to the cycle before it comes round again
+void SimFast::BuildFrame() {
+	SimFast_Pixie start;
+	memset(&start, 0, sizeof(start));
+	start.vertical_pixel_counter = 1;
+	start.horizontal_pixel_counter = 1;
+
+	// One lap to settle the registered flags, then record the next
+	SimFast_Pixie pixie = start;
+	do { pixie.Clock(); } while (!pixie.SameCounters(start));
+	frame.clear();
+	do {
+		frame.push_back(pixie);
+		pixie.Clock();
+	} while (!pixie.SameCounters(start));
+}
+
+bool SimFast::SetPixie(const SimFast_Pixie& pixie) {
+	for (size_t pos = 0; pos < frame.size(); pos++) {
+		if (frame[pos].SameCounters(pixie)) {
+			frame_pos = (int)pos;
+			return true;
+		}
+	}
+	return false;
+}
+
+bool SimFast::InHandoffWindow() {
+	const SimFast_Pixie& pixie = frame[frame_pos];
+	return pixie.video_state == SM_VBLANK && pixie.vertical_pixel_counter >= handoff_first_line &&
+		pixie.vertical_pixel_counter <= handoff_last_line;
+}
+
+// 64x128: each display memory row of 8 bytes is shown on 4 lines
+void SimFast::Render() {
+	uint32_t line[64];
+	for (int y = 0; y < 128; y++) {
+		const uint8_t* row = ram + 0x900 + (y / 4) * 8;
+		for (int x = 0; x < 64; x++) {
+			line[x] = (row[x >> 3] << (x & 7)) & 0x80 ? 0xFFFFFFFF : 0xFF000000;
+		}
+		video->Line(line, 64);
+	}
+	video->EndFrame();
+}
+
+// CPU
+// ---
+// Each handler returns the clk_sys cycles cdp1802.v takes: FETCH, EXECUTE
+// and EXECUTE2 when the instruction reads memory; short branches add
+// BRANCH3 when taken, long branches BRANCH2 and BRANCH3, or SKIP. Where the
+// RTL differs from a real 1802 the handlers follow the RTL:
+//  00        LDN R0, no idle
+//  70 71 78 79  RET, DIS, SAV and MARK only read M(R(X))
+//  C4-C7, CC-CF  long branches on the C0-C3 conditions, no skips
+//  68-6F     INP stores cpu_din, which rcastudioii.sv never drives (0)
+// and interrupts and DMA are not served.
+
+bool SimFast::Flag(int n) {
+	switch (n & 3) {
+	case 0: return frame[(frame_pos + 1) % frame.size()].EFx;	// Sampled in EXECUTE
+	case 1: return true;
+	case 2: return (*keypad_a >> keylatch) & 1;
+	default: return (*keypad_b >> keylatch) & 1;
+	}
+}
+
+// cdp1802.v "sense" for branch opcode n
+static bool sense(SimFast& c, int n, bool long_branch) {
+	if (!long_branch && (n & 4)) { return c.Flag(n); }
+	switch (n & 3) {
+	case 0: return true;
+	case 1: return c.Q;
+	case 2: return c.D == 0;
+	default: return c.DF;
+	}
+}
+
+static int op_ldn(SimFast& c, int n) { c.D = c.Read(c.R[n]); return 3; }
+static int op_inc(SimFast& c, int n) { c.R[n]++; return 2; }
+static int op_dec(SimFast& c, int n) { c.R[n]--; return 2; }
+static int op_lda(SimFast& c, int n) { c.D = c.Read(c.R[n]++); return 3; }
+static int op_str(SimFast& c, int n) { c.Write(c.R[n], c.D); return 2; }
+static int op_glo(SimFast& c, int n) { c.D = (uint8_t)c.R[n]; return 2; }
+static int op_ghi(SimFast& c, int n) { c.D = c.R[n] >> 8; return 2; }
+static int op_plo(SimFast& c, int n) { c.R[n] = (c.R[n] & 0xFF00) | c.D; return 2; }
+static int op_phi(SimFast& c, int n) { c.R[n] = (c.R[n] & 0x00FF) | (c.D << 8); return 2; }
+static int op_sep(SimFast& c, int n) { c.P = n; return 2; }
+static int op_sex(SimFast& c, int n) { c.X = n; return 2; }
+
+static int op_short_branch(SimFast& c, int n) {
+	uint8_t target = c.Read(c.R[c.P]++);
+	if (sense(c, n, false) == ((n & 8) != 0)) { return 2; }
+	c.R[c.P] = (c.R[c.P] & 0xFF00) | target;
+	return 3;
+}
+
+static int op_long_branch(SimFast& c, int n) {
+	if (sense(c, n, true) == ((n & 8) != 0)) {
+		c.R[c.P] += 2;
+		return 3;
+	}
+	uint8_t high = c.Read(c.R[c.P]++);
+	c.R[c.P] = (high << 8) | c.Read(c.R[c.P]);
+	return 4;
+}
+
+static int op_irx(SimFast& c, int n) { c.R[c.X]++; return 3; }
+
+static int op_out(SimFast& c, int n) {
+	uint8_t value = c.Read(c.R[c.X]++);
+	if (n & 2) { c.keylatch = value & 15; }	// Keypad latch on io_n[1]
+	return 3;
+}
+
+static int op_inp(SimFast& c, int n) {
+	c.D = 0;
+	c.Write(c.R[c.X], c.D);
+	return 2;
+}
+
+static int op_read_only(SimFast& c, int n) { return 3; }
+static int op_ldxa(SimFast& c, int n) { c.D = c.Read(c.R[c.X]++); return 3; }
+static int op_stxd(SimFast& c, int n) { c.Write(c.R[c.X]--, c.D); return 2; }
+static int op_req(SimFast& c, int n) { c.Q = false; return 3; }
+static int op_seq(SimFast& c, int n) { c.Q = true; return 3; }
+
+// ALU operand: immediate for 7C-7F and F8-FF, else M(R(X))
+static uint8_t operand(SimFast& c, int n) {
+	return (n & 8) ? c.Read(c.R[c.P]++) : c.Read(c.R[c.X]);
+}
+
+static void result(SimFast& c, int value) {
+	c.DF = (value >> 8) & 1;
+	c.D = (uint8_t)value;
+}
+
+static int op_ldx(SimFast& c, int n) { c.D = operand(c, n); return 3; }
+static int op_or(SimFast& c, int n) { c.D |= operand(c, n); return 3; }
+static int op_and(SimFast& c, int n) { c.D &= operand(c, n); return 3; }
+static int op_xor(SimFast& c, int n) { c.D ^= operand(c, n); return 3; }
+static int op_add(SimFast& c, int n) { result(c, c.D + operand(c, n)); return 3; }
+static int op_sd(SimFast& c, int n) { result(c, 0x100 + operand(c, n) - c.D); return 3; }
+static int op_sm(SimFast& c, int n) { int m = operand(c, n); result(c, 0x100 + c.D - m); return 3; }
+static int op_adc(SimFast& c, int n) { result(c, c.D + operand(c, n) + c.DF); return 3; }
+static int op_sdb(SimFast& c, int n) { result(c, 0x100 + operand(c, n) - c.D - !c.DF); return 3; }
+static int op_smb(SimFast& c, int n) { int m = operand(c, n); result(c, 0x100 + c.D - m - !c.DF); return 3; }
+static int op_shr(SimFast& c, int n) { result(c, ((c.D & 1) << 8) | (c.D >> 1)); return 3; }
+static int op_shl(SimFast& c, int n) { result(c, c.D << 1); return 3; }
+static int op_shrc(SimFast& c, int n) { result(c, ((c.D & 1) << 8) | (c.DF << 7) | (c.D >> 1)); return 3; }
+static int op_shlc(SimFast& c, int n) { result(c, (c.D << 1) | c.DF); return 3; }
+
+SimFast_Handler SimFast::handlers[256];
+
+SimFast::SimFast() {
+	memset(R, 0, sizeof(R));
+	P = 0;
+	X = 0;
+	D = 0;
+	DF = false;
+	Q = false;
+	memset(ram, 0, sizeof(ram));
+	keylatch = 0;
+	keypad_a = NULL;
+	keypad_b = NULL;
+	video = NULL;
+	active = false;
+	frame_pos = 0;
+	instructions = 0;
+
+	static const SimFast_Handler group[16] = {
+		op_ldn, op_inc, op_dec, op_short_branch, op_lda, op_str, NULL, NULL,
+		op_glo, op_ghi, op_plo, op_phi, op_long_branch, op_sep, op_sex, NULL
+	};
+	static const SimFast_Handler group_7[16] = {
+		op_read_only, op_read_only, op_ldxa, op_stxd, op_adc, op_sdb, op_shrc, op_smb,
+		op_read_only, op_read_only, op_req, op_seq, op_adc, op_sdb, op_shlc, op_smb
+	};
+	static const SimFast_Handler group_F[16] = {
+		op_ldx, op_or, op_and, op_xor, op_add, op_sd, op_shr, op_sm,
+		op_ldx, op_or, op_and, op_xor, op_add, op_sd, op_shl, op_sm
+	};
+	for (int op = 0; op < 256; op++) {
+		int i = op >> 4;
+		int n = op & 15;
+		if (i == 0x6) { handlers[op] = n == 0 ? op_irx : n < 8 ? op_out : op_inp; }
+		else if (i == 0x7) { handlers[op] = group_7[n]; }
+		else if (i == 0xF) { handlers[op] = group_F[n]; }
+		else { handlers[op] = group[i]; }
+	}
+
+	BuildFrame();
+}
+
+int SimFast::Step() {
+	uint8_t op = Read(R[P]++);
+	int cycles = handlers[op](*this, op & 15);
+	instructions++;
+
+	frame_pos += cycles;
+	if (frame_pos >= (int)frame.size()) {
+		frame_pos -= (int)frame.size();
+		if (video) { Render(); }
+	}
+	return cycles;
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include "verilated_heavy.h"
+#include "sim_video.h"
+#include <atomic>
+#include <vector>
+
+// Fast functional engine
+// ----------------------
+// Runs the Studio II as the RTL builds it, one whole instruction per Step(),
+// in tens of ns an instruction instead of a Verilated eval per clock edge:
+//
+// - the CPU executes the instruction set the way cdp1802.v does (opcodes it
+//   leaves out or maps differently behave the same here, see sim_fast.cpp)
+//   and takes its clk_sys cycle count, so timing stays in step with the RTL
+// - the 4K DPRAM with its 0x800-0x9FF write window, the keypad latch and EF
+//   inputs as wired in rcastudioii.sv
+// - the Pixie counters as pixie_video_studioii.v runs them. The frame is the
+//   same every time, so it is simulated once and the engine only keeps its
+//   position in it; the picture is drawn from display memory once a frame.
+//
+// Opcodes are decoded once into a 256 entry handler table. The state can be
+// taken from and handed back to the Verilated model (fastFromRTL() and
+// fastToRTL() in sim_core) during vertical blank, where the Pixie state is
+// only its two counters.
+
+// pixie_video_studioii.v registers
+struct SimFast_Pixie {
+	int vertical_pixel_counter;
+	int horizontal_pixel_counter;
+	int video_state;
+	int pixel_state;
+	int line_repeat_counter;
+	int row_cache_counter;
+	int video_byte_counter;
+	int byte_counter;
+	int nbit;
+	bool EFx;
+	bool INT;
+	bool VSync;
+	bool HSync;
+	bool VBlank;
+	bool HBlank;
+
+	// One clk_sys cycle of the video state machine
+	void Clock();
+	// Counters and states equal (the flags follow from them)
+	bool SameCounters(const SimFast_Pixie& other) const;
+};
+
+struct SimFast;
+typedef int (*SimFast_Handler)(SimFast& cpu, int n);
+
+struct SimFast {
+public:
+	// CPU registers, as cdp1802.v holds them
+	uint16_t R[16];
+	uint8_t P;
+	uint8_t X;
+	uint8_t D;
+	bool DF;
+	bool Q;
+
+	uint8_t ram[4096];
+	uint8_t keylatch;
+	const SData* keypad_a;	// playerA/playerB, written by SimInput
+	const SData* keypad_b;
+	SimVideo* video;
+
+	std::atomic<bool> active;	// Running instead of the RTL
+	int frame_pos;		// clk_sys cycles into the Pixie frame
+	vluint64_t instructions;
+
+	SimFast();
+
+	// One instruction, returns its clk_sys cycles
+	int Step();
+
+	// Pixie state at the current position, and the position for a state
+	// read from the RTL (false when it is not part of the steady frame)
+	const SimFast_Pixie& Pixie() { return frame[frame_pos]; }
+	bool SetPixie(const SimFast_Pixie& pixie);
+	// Vertical blank lines where a handoff only needs the counters
+	bool InHandoffWindow();
+
+	int FrameCycles() { return (int)frame.size(); }
+
+	uint8_t Read(uint16_t address) { return ram[address & 0xFFF]; }
+	void Write(uint16_t address, uint8_t value) {
+		address &= 0xFFF;
+		if (address >= 0x800 && address < 0xA00) { ram[address] = value; }
+	}
+	bool Flag(int n);
+
+private:
+	static SimFast_Handler handlers[256];
+	std::vector<SimFast_Pixie> frame;
+
+	void BuildFrame();
+	void Render();
+};
@@ -0,0 +1,84 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+// 64-bit content hash (XXH64). The bulk loop keeps four independent lanes
+// over 32 byte stripes so they pipeline well. Assumes a little-endian host.
+
+static const uint64_t sim_hash_prime1 = 11400714785074694791ULL;
+static const uint64_t sim_hash_prime2 = 14029467366897019727ULL;
+static const uint64_t sim_hash_prime3 = 1609587929392839161ULL;
+static const uint64_t sim_hash_prime4 = 9650029242287828579ULL;
+static const uint64_t sim_hash_prime5 = 2870177450012600261ULL;
+
+static inline uint64_t SimHash_Rotl(uint64_t x, int r) { return (x << r) | (x >> (64 - r)); }
+
+static inline uint64_t SimHash_Read64(const unsigned char* p) { uint64_t v; memcpy(&v, p, 8); return v; }
+static inline uint32_t SimHash_Read32(const unsigned char* p) { uint32_t v; memcpy(&v, p, 4); return v; }
+
+static inline uint64_t SimHash_Round(uint64_t acc, uint64_t input) {
+	acc += input * sim_hash_prime2;
+	acc = SimHash_Rotl(acc, 31);
+	return acc * sim_hash_prime1;
+}
+
+static inline uint64_t SimHash_Merge(uint64_t acc, uint64_t lane) {
+	acc ^= SimHash_Round(0, lane);
+	return acc * sim_hash_prime1 + sim_hash_prime4;
+}
+
+static inline uint64_t SimHash64(const void* data, size_t length, uint64_t seed = 0) {
+	const unsigned char* p = (const unsigned char*)data;
+	const unsigned char* end = p + length;
+	uint64_t h;
+
+	if (length >= 32) {
+		uint64_t v1 = seed + sim_hash_prime1 + sim_hash_prime2;
+		uint64_t v2 = seed + sim_hash_prime2;
+		uint64_t v3 = seed;
+		uint64_t v4 = seed - sim_hash_prime1;
+		const unsigned char* limit = end - 32;
+		do {
+			v1 = SimHash_Round(v1, SimHash_Read64(p));
+			v2 = SimHash_Round(v2, SimHash_Read64(p + 8));
+			v3 = SimHash_Round(v3, SimHash_Read64(p + 16));
+			v4 = SimHash_Round(v4, SimHash_Read64(p + 24));
+			p += 32;
+		} while (p <= limit);
+		h = SimHash_Rotl(v1, 1) + SimHash_Rotl(v2, 7) + SimHash_Rotl(v3, 12) + SimHash_Rotl(v4, 18);
+		h = SimHash_Merge(h, v1);
+		h = SimHash_Merge(h, v2);
+		h = SimHash_Merge(h, v3);
+		h = SimHash_Merge(h, v4);
+	}
+	else {
+		h = seed + sim_hash_prime5;
+	}
+	h += (uint64_t)length;
+
+	// Tail
+	while (p + 8 <= end) {
+		h ^= SimHash_Round(0, SimHash_Read64(p));
+		h = SimHash_Rotl(h, 27) * sim_hash_prime1 + sim_hash_prime4;
+		p += 8;
+	}
+	if (p + 4 <= end) {
+		h ^= (uint64_t)SimHash_Read32(p) * sim_hash_prime1;
+		h = SimHash_Rotl(h, 23) * sim_hash_prime2 + sim_hash_prime3;
+		p += 4;
+	}
+	while (p < end) {
+		h ^= (*p) * sim_hash_prime5;
+		h = SimHash_Rotl(h, 11) * sim_hash_prime1;
+		p++;
+	}
+
+	// Avalanche
+	h ^= h >> 33;
+	h *= sim_hash_prime2;
+	h ^= h >> 29;
+	h *= sim_hash_prime3;
+	h ^= h >> 32;
+	return h;
+}
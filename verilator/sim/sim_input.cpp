@@ -1,9 +1,11 @@
 #include "sim_input.h"
 
 #include <string>
+#include <string.h>
 #include <stdlib.h>
 
-#ifndef _MSC_VER
+#ifdef SIM_HEADLESS
+#elif !defined(_MSC_VER)
 #include <SDL2/SDL.h>
 int m_keyboardStateCount;
 const Uint8* m_keyboardState;
@@ -521,6 +523,21 @@ static const int ev2ps2[] =
 };
 /* http://www-personal.umich.edu/~bazald/l/api/_s_d_l__scancode_8h.html */
 #endif
+// Studio II keypads, bits 0-9 of playerA/playerB. Same keys as the PS/2
+// decode in rcastudioii.sv: 0-9 for keypad A, P Q W E R T Y U I O for B.
+#ifdef WIN32
+static const int keypad_keys[2][10] = {
+	{ DIK_0, DIK_1, DIK_2, DIK_3, DIK_4, DIK_5, DIK_6, DIK_7, DIK_8, DIK_9 },
+	{ DIK_P, DIK_Q, DIK_W, DIK_E, DIK_R, DIK_T, DIK_Y, DIK_U, DIK_I, DIK_O }
+};
+#elif !defined(SIM_HEADLESS)
+static const int keypad_keys[2][10] = {
+	{ SDL_SCANCODE_0, SDL_SCANCODE_1, SDL_SCANCODE_2, SDL_SCANCODE_3, SDL_SCANCODE_4, SDL_SCANCODE_5, SDL_SCANCODE_6, SDL_SCANCODE_7, SDL_SCANCODE_8, SDL_SCANCODE_9 },
+	{ SDL_SCANCODE_P, SDL_SCANCODE_Q, SDL_SCANCODE_W, SDL_SCANCODE_E, SDL_SCANCODE_R, SDL_SCANCODE_T, SDL_SCANCODE_Y, SDL_SCANCODE_U, SDL_SCANCODE_I, SDL_SCANCODE_O }
+};
+#endif
+
+#ifndef SIM_HEADLESS
 bool ReadKeyboard()
 {
 #ifdef WIN32
@@ -542,6 +559,7 @@ bool ReadKeyboard()
 
 	return true;
 }
+#endif
 
 int SimInput::Initialise() {
 
@@ -566,6 +584,7 @@ int SimInput::Initialise() {
 }
 
 void SimInput::Read() {
+#ifndef SIM_HEADLESS
 	// Read keyboard state
 	bool pr = ReadKeyboard();
 
@@ -578,6 +597,28 @@ void SimInput::Read() {
 #endif
 	}
 
+	// Direct keypad replaces the PS/2 key events
+	if (direct_keypad) {
+		uint32_t keypad = 0;
+		for (int pad = 0; pad < 2; pad++) {
+			for (int key = 0; key < 10; key++) {
+#ifdef WIN32
+				bool down = m_keyboardState[keypad_keys[pad][key]] & 0x80;
+#else
+				bool down = m_keyboardState[keypad_keys[pad][key]];
+#endif
+				if (down) { keypad |= 1 << (pad * 10 + key); }
+			}
+		}
+		live_keypad = keypad;
+#ifdef WIN32
+		memcpy(m_keyboardState_last, m_keyboardState, sizeof(m_keyboardState_last));
+#else
+		memcpy(m_keyboardState_last, m_keyboardState, m_keyboardStateCount);
+#endif
+		return;
+	}
+
 #ifdef WIN32
 	for (unsigned char k = 0; k < 220; k++) {
 
@@ -585,20 +626,22 @@ void SimInput::Read() {
 			unsigned int ext = ev2ps2[k] & EXT;
 			//fprintf(stderr, "ev2ps2[k] = %x  ext = %x  temp = %x\n", ev2ps2[k], ext, EXT | 0x6b);
 			SimInput_PS2KeyEvent evt = SimInput_PS2KeyEvent(k, m_keyboardState[k], ext, ev2ps2[k]);
-			keyEvents.push(evt);
+			keyEvents.Push(evt);
 		}
 		m_keyboardState_last[k] = m_keyboardState[k];
 	}
 #else
 	for (int k = 0; k < m_keyboardStateCount; k++) {
 		if (m_keyboardState_last[k] != m_keyboardState[k]) {
-			bool ext = 0;
-			SimInput_PS2KeyEvent evt = SimInput_PS2KeyEvent(k, m_keyboardState[k], ext);
-			keyEvents.push(evt);
+			unsigned int mapped = k < (int)(sizeof(ev2ps2) / sizeof(ev2ps2[0])) ? ev2ps2[k] : NONE;
+			bool ext = mapped & EXT;
+			SimInput_PS2KeyEvent evt = SimInput_PS2KeyEvent(k, m_keyboardState[k], ext, mapped);
+			keyEvents.Push(evt);
 		}
 		m_keyboardState_last[k] = m_keyboardState[k];
 	}
 #endif
+#endif
 
 }
 
@@ -611,6 +654,7 @@ void SimInput::SetMapping(int index, int code) {
 }
 
 void SimInput::CleanUp() {
+	StopMovie();
 
 #ifdef WIN32
 	// Release keyboard
@@ -624,17 +668,49 @@ unsigned int ps2_key_temp;
 bool ps2_clock = 1;
 
 
-void SimInput::BeforeEval()
+void SimInput::BeforeEval(vluint64_t time)
 {
+	// Replay drives the core from the movie only, live input is dropped
+	if (movie_mode == MOVIE_REPLAY) {
+		SimInput_PS2KeyEvent dropped;
+		while (keyEvents.Pop(dropped)) {}
+		while (movie_pos < movie.size() && movie[movie_pos].time <= time) {
+			ApplyEvent(movie[movie_pos++]);
+		}
+		if (movie_pos == movie.size()) {
+			console.AddLog("Movie replay finished at %llu", (unsigned long long)time);
+			StopMovie();
+		}
+		return;
+	}
+
+	if (inputs_port && live_inputs != last_inputs) {
+		*inputs_port = live_inputs;
+		last_inputs = live_inputs;
+		last_event_time = time;
+		RecordEvent(time, 'I', live_inputs);
+	}
+
+	// Leaving direct mode releases the keys it was holding
+	if (keypad_a && keypad_b && (direct_keypad || last_keypad)) {
+		uint32_t keypad = direct_keypad ? (uint32_t)live_keypad : 0;
+		if (keypad != last_keypad) {
+			*keypad_a = keypad & 0x3FF;
+			*keypad_b = (keypad >> 10) & 0x3FF;
+			last_keypad = keypad;
+			last_event_time = time;
+			RecordEvent(time, 'P', keypad);
+		}
+	}
+
 	if (ps2_key == NULL) {
 		return;
 	}
 	if (keyEventTimer == 0) {
 
-		if (keyEvents.size() > 0) {
+		SimInput_PS2KeyEvent evt;
+		if (keyEvents.Pop(evt)) {
 			// Get chunk from queue
-			SimInput_PS2KeyEvent evt = keyEvents.front();
-			keyEvents.pop();
 			ps2_key_temp = evt.mapped;
 			if (evt.extended) { ps2_key_temp |= (1UL << 8); }
 			if (evt.pressed) { ps2_key_temp |= (1UL << 9); }
@@ -642,6 +718,8 @@ void SimInput::BeforeEval()
 			ps2_clock = !ps2_clock;
 			*ps2_key = ps2_key_temp;
 			keyEventTimer = keyEventWait;
+			last_event_time = time;
+			RecordEvent(time, 'K', ps2_key_temp);
 		}
 	}
 	else {
@@ -649,6 +727,81 @@ void SimInput::BeforeEval()
 	}
 }
 
+// Input movie
+// -----------
+
+void SimInput::RecordEvent(vluint64_t time, char type, unsigned int value) {
+	if (movie_mode != MOVIE_RECORD || !movie_out) { return; }
+	fprintf(movie_out, "%llu %c %x\n", (unsigned long long)time, type, value);
+}
+
+void SimInput::ApplyEvent(const SimInput_MovieEvent& event) {
+	last_event_time = event.time;
+	if (event.type == 'I' && inputs_port) {
+		*inputs_port = event.value;
+		last_inputs = event.value;
+	}
+	if (event.type == 'K' && ps2_key) {
+		*ps2_key = event.value;
+		// Next live key must flip the strobe bit again
+		ps2_clock = !(event.value & (1UL << 10));
+	}
+	if (event.type == 'P' && keypad_a && keypad_b) {
+		*keypad_a = event.value & 0x3FF;
+		*keypad_b = (event.value >> 10) & 0x3FF;
+		last_keypad = event.value;
+	}
+}
+
+// Start recording at time, beginning with the current inputs
+bool SimInput::RecordMovie(const char* file, vluint64_t time) {
+	StopMovie();
+	movie_out = fopen(file, "w");
+	if (!movie_out) {
+		console.AddLog("Cannot write movie %s", file);
+		return false;
+	}
+	fprintf(movie_out, "# main_time type value (I = inputs bitmask, K = ps2_key, P = keypads B << 10 | A)\n");
+	movie_mode = MOVIE_RECORD;
+	RecordEvent(time, 'I', last_inputs);
+	console.AddLog("Recording movie %s from %llu", file, (unsigned long long)time);
+	return true;
+}
+
+bool SimInput::ReplayMovie(const char* file) {
+	StopMovie();
+	FILE* in = fopen(file, "r");
+	if (!in) {
+		console.AddLog("Cannot read movie %s", file);
+		return false;
+	}
+	movie.clear();
+	char line[128];
+	while (fgets(line, sizeof(line), in)) {
+		if (line[0] == '#') { continue; }
+		unsigned long long time;
+		char type;
+		unsigned int value;
+		if (sscanf(line, "%llu %c %x", &time, &type, &value) == 3 && (type == 'I' || type == 'K' || type == 'P')) {
+			movie.push_back({ (vluint64_t)time, type, value });
+		}
+	}
+	fclose(in);
+	movie_pos = 0;
+	keyEventTimer = 0;
+	movie_mode = MOVIE_REPLAY;
+	console.AddLog("Replaying movie %s, %d events", file, (int)movie.size());
+	return true;
+}
+
+void SimInput::StopMovie() {
+	if (movie_out) {
+		fclose(movie_out);
+		movie_out = NULL;
+	}
+	movie_mode = MOVIE_OFF;
+}
+
 SimInput::SimInput(int count, DebugConsole c)
 {
 	inputCount = count;
@@ -8,6 +8,9 @@
 #include "verilated_heavy.h"
 #include <queue>
 #include <vector>
+#include <string>
+#include <stdio.h>
+#include "sim_lockfree.h"
 
 
 struct SimInput_PS2KeyEvent {
@@ -17,6 +20,13 @@ public:
 	bool extended;
 	unsigned int mapped;
 
+	SimInput_PS2KeyEvent() {
+		this->code = 0;
+		this->pressed = false;
+		this->extended = false;
+		this->mapped = 0;
+	}
+
 	SimInput_PS2KeyEvent(char code, bool pressed, bool extended, unsigned int mapped) {
 		this->code = code;
 		this->pressed = pressed;
@@ -25,6 +35,21 @@ public:
 	}
 };
 
+// Input movie
+// -----------
+// One text line per change seen by the core, "<main_time> I <mask>" for the
+// inputs bitmask, "<main_time> K <ps2_key>" for each PS/2 key word and
+// "<main_time> P <keypads>" for direct keypad states (B << 10 | A).
+// Replaying applies them at the same main_time, so a run from the same
+// start is cycle for cycle repeatable.
+enum SimInput_MovieMode { MOVIE_OFF, MOVIE_RECORD, MOVIE_REPLAY };
+
+struct SimInput_MovieEvent {
+	vluint64_t time;
+	char type;
+	unsigned int value;
+};
+
 struct SimInput {
 public:
 
@@ -33,10 +58,31 @@ public:
 	int mappings[16];
 
 	SData* ps2_key = NULL;
-	std::queue<SimInput_PS2KeyEvent> keyEvents;
+	// Filled by Read() on the GUI thread, drained by BeforeEval() on the sim thread
+	SimRing<SimInput_PS2KeyEvent, 256> keyEvents;
 	unsigned int keyEventTimer = 0;
 	unsigned int keyEventWait = 50000;
 
+	// Core inputs bitmask, driven from live_inputs (set by the sim thread)
+	// or from the movie in BeforeEval()
+	SData* inputs_port = NULL;
+	uint32_t live_inputs = 0;
+
+	// Direct keypad mode: Read() turns the keyboard into the two Studio II
+	// keypad states and BeforeEval() writes them to playerA/playerB in one
+	// cycle, skipping PS/2 serialisation and keyEventWait
+	SData* keypad_a = NULL;
+	SData* keypad_b = NULL;
+	std::atomic<bool> direct_keypad{ false };
+	std::atomic<uint32_t> live_keypad{ 0 };
+
+	// main_time of the last input change applied to the core
+	vluint64_t last_event_time = 0;
+
+	std::atomic<int> movie_mode{ MOVIE_OFF };
+	std::vector<SimInput_MovieEvent> movie;
+	size_t movie_pos = 0;
+
 #define NONE         0xFF
 #define LCTRL        0x000100
 #define LSHIFT       0x000200
@@ -59,7 +105,17 @@ public:
 	int Initialise();
 	void CleanUp();
 	void SetMapping(int index, int code);
-	void BeforeEval(void);
+	void BeforeEval(vluint64_t time);
+	bool RecordMovie(const char* file, vluint64_t time);
+	bool ReplayMovie(const char* file);
+	void StopMovie();
 	SimInput(int count, DebugConsole c);
 	~SimInput();
+
+private:
+	FILE* movie_out = NULL;
+	uint32_t last_inputs = 0;
+	uint32_t last_keypad = 0;
+	void RecordEvent(vluint64_t time, char type, unsigned int value);
+	void ApplyEvent(const SimInput_MovieEvent& event);
 };
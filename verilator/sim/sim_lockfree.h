@@ -0,0 +1,88 @@
+#pragma once
+#include <atomic>
+#include <stddef.h>
+
+// Triple-buffered mailbox between one producer and one consumer thread.
+// The producer fills Back() and calls Publish(), the consumer calls Update()
+// and reads Front(). Neither side blocks, and the consumer always gets the
+// most recently published buffer (older unread ones are dropped).
+template <typename T>
+struct SimMailbox {
+public:
+	T buffers[3];
+
+	SimMailbox() {
+		back = 0;
+		front = 1;
+		middle = 2;
+	}
+
+	T& Back() { return buffers[back]; }
+	T& Front() { return buffers[front]; }
+
+	// Producer: hand the back buffer over and take the spare one
+	void Publish() {
+		int old = middle.exchange(back | fresh, std::memory_order_acq_rel);
+		back = old & index_mask;
+	}
+
+	// Consumer: swap in the latest buffer, returns false if nothing new
+	bool Update() {
+		if ((middle.load(std::memory_order_relaxed) & fresh) == 0) { return false; }
+		int old = middle.exchange(front, std::memory_order_acq_rel);
+		front = old & index_mask;
+		return true;
+	}
+
+private:
+	static const int fresh = 4;
+	static const int index_mask = 3;
+	int back;
+	int front;
+	std::atomic<int> middle;
+};
+
+// Bounded single-producer/single-consumer ring. Push() fails when full and
+// Pop() fails when empty, neither ever waits. Size must be a power of two.
+template <typename T, size_t Size>
+struct SimRing {
+public:
+	static_assert((Size & (Size - 1)) == 0, "SimRing size must be a power of two");
+
+	SimRing() {
+		head = 0;
+		tail = 0;
+	}
+
+	bool Push(const T& item) {
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == Size) { return false; }
+		items[h & (Size - 1)] = item;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool Pop(T& item) {
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire)) { return false; }
+		item = items[t & (Size - 1)];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	size_t Count() const {
+		return head.load(std::memory_order_acquire) - tail.load(std::memory_order_acquire);
+	}
+
+	bool Empty() const { return Count() == 0; }
+
+	// Consumer: drop everything queued
+	void Clear() {
+		tail.store(head.load(std::memory_order_acquire), std::memory_order_release);
+	}
+
+private:
+	T items[Size];
+	alignas(64) std::atomic<size_t> head;
+	alignas(64) std::atomic<size_t> tail;
+};
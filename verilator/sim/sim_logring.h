@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include <string.h>
+
+// Fixed-size log storage
+// ----------------------
+// Lines are kept in a ring of MaxLines records pointing into a circular
+// byte arena, each line NUL-terminated and contiguous. Appending wraps the
+// arena and evicts the oldest lines it overwrites, so memory stays fixed
+// however much is logged. Lines are numbered by total so a view can refer
+// to them across evictions. Not thread safe, the caller locks.
+//
+// Live lines are always in write order: the tail of the previous lap at
+// offsets from head on, then the current lap below head. A lap that ended
+// early can leave lines past where the next lap wraps, so a wrap first
+// evicts everything at or past the old head.
+template <int MaxLines, int ArenaSize, int MaxLength>
+struct SimLogRing {
+public:
+	struct Line {
+		int offset;
+		int length;
+	};
+
+	Line lines[MaxLines];
+	char arena[ArenaSize];
+	int head = 0;		// Next free arena byte
+	int count = 0;		// Lines held
+	uint64_t total = 0;	// Lines ever added, the newest is total - 1
+
+	uint64_t First() const { return total - count; }
+	const Line& Get(uint64_t number) const { return lines[number % MaxLines]; }
+	const char* Text(uint64_t number) const { return &arena[Get(number).offset]; }
+
+	void Clear() {
+		count = 0;
+		head = 0;
+	}
+
+	// Append one line, cut to MaxLength - 1 characters
+	void Append(const char* text, int length) {
+		if (length > MaxLength - 1) { length = MaxLength - 1; }
+		int size = length + 1;
+		if (head + size > ArenaSize) {
+			int old_head = head;
+			head = 0;
+			while (count > 0 && Get(First()).offset >= old_head) { count--; }
+		}
+		// Evict the oldest lines that the new text overlaps, or one for a full ring
+		while (count > 0) {
+			const Line& oldest = Get(First());
+			bool overlaps = oldest.offset < head + size && oldest.offset + oldest.length + 1 > head;
+			if (!overlaps && count < MaxLines) { break; }
+			count--;
+		}
+		memcpy(&arena[head], text, length);
+		arena[head + length] = 0;
+		Line& line = lines[total % MaxLines];
+		line.offset = head;
+		line.length = length;
+		head += size;
+		count++;
+		total++;
+	}
+};
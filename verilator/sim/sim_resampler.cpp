@@ -0,0 +1,219 @@
+#include "sim_resampler.h"
+#include <math.h>
+#include <string.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define SIM_RESAMPLER_SSE2
+#include <emmintrin.h>
+#endif
+
+// SIMD kernels
+// ------------
+
+// Sum of a[i] * w[i] for int16 data, n a multiple of 8. Each 32-bit lane
+// gathers n/4 products, which stays in range for decimation <= 256.
+static inline int64_t dotInt16(const int16_t* a, const int16_t* w, int n) {
+#ifdef SIM_RESAMPLER_SSE2
+	__m128i acc = _mm_setzero_si128();
+	for (int i = 0; i < n; i += 8) {
+		__m128i x = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i y = _mm_loadu_si128((const __m128i*)(w + i));
+		acc = _mm_add_epi32(acc, _mm_madd_epi16(x, y));
+	}
+	int32_t lanes[4];
+	_mm_storeu_si128((__m128i*)lanes, acc);
+	return (int64_t)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+#else
+	int64_t acc = 0;
+	for (int i = 0; i < n; i++) { acc += (int32_t)a[i] * w[i]; }
+	return acc;
+#endif
+}
+
+// Two dot products sharing the coefficients, n a multiple of 4
+static inline void dotFloat2(const float* l, const float* r, const float* c, int n, float& outL, float& outR) {
+#ifdef SIM_RESAMPLER_SSE2
+	__m128 accL = _mm_setzero_ps();
+	__m128 accR = _mm_setzero_ps();
+	for (int i = 0; i < n; i += 4) {
+		__m128 k = _mm_loadu_ps(c + i);
+		accL = _mm_add_ps(accL, _mm_mul_ps(_mm_loadu_ps(l + i), k));
+		accR = _mm_add_ps(accR, _mm_mul_ps(_mm_loadu_ps(r + i), k));
+	}
+	float lanesL[4], lanesR[4];
+	_mm_storeu_ps(lanesL, accL);
+	_mm_storeu_ps(lanesR, accR);
+	outL = (lanesL[0] + lanesL[1]) + (lanesL[2] + lanesL[3]);
+	outR = (lanesR[0] + lanesR[1]) + (lanesR[2] + lanesR[3]);
+#else
+	float accL = 0, accR = 0;
+	for (int i = 0; i < n; i++) {
+		accL += l[i] * c[i];
+		accR += r[i] * c[i];
+	}
+	outL = accL;
+	outR = accR;
+#endif
+}
+
+// Filter design
+// -------------
+
+const double sim_pi = 3.14159265358979323846;
+
+static double besselI0(double x) {
+	double sum = 1.0, term = 1.0;
+	for (int k = 1; k < 32; k++) {
+		term *= (x / (2.0 * k)) * (x / (2.0 * k));
+		sum += term;
+	}
+	return sum;
+}
+
+SimResampler::SimResampler() {
+	input_rate = 0;
+	output_rate = 0;
+	output_count = 0;
+	decimation = 1;
+	window = 0;
+	history = 0;
+	input_pos = 0;
+	input_end = 0;
+	cic_gain = 0;
+	mid_count = 0;
+	position = 0;
+	position_frac = 0;
+	position_den = 1;
+}
+
+void SimResampler::Initialise(int inputRate, int outputRate) {
+	input_rate = inputRate;
+	output_rate = outputRate;
+
+	// Stage 1 lands on about 8x the output rate
+	decimation = (int)((double)inputRate / (8.0 * outputRate) + 0.5);
+	if (decimation < 1) { decimation = 1; }
+	if (decimation > 256) { decimation = 256; }
+	window = ((2 * decimation - 1) + 7) & ~7;
+	history = window - decimation;
+
+	input_l.assign(history + block_outputs * decimation, 0);
+	input_r.assign(history + block_outputs * decimation, 0);
+	input_pos = history;
+	input_end = (int)input_l.size();
+
+	// Stage 2 starts with a full window of silence
+	mid_l.assign(taps - 1 + block_outputs, 0.0f);
+	mid_r.assign(taps - 1 + block_outputs, 0.0f);
+	mid_count = taps - 1;
+	position = taps - 1;
+	position_frac = 0;
+	position_den = (uint64_t)decimation * outputRate;
+
+	BuildFilters();
+
+	// Enough room for one block at the worst rounding
+	output.assign(2 * ((int64_t)block_outputs * decimation * outputRate / inputRate + 4), 0.0f);
+	output_count = 0;
+}
+
+void SimResampler::BuildFilters() {
+	// Triangular weights of a second-order CIC, newest sample last
+	cic_weights.assign(window, 0);
+	for (int i = 0; i < window; i++) {
+		int k = window - 1 - i;
+		if (k < 2 * decimation - 1) {
+			cic_weights[i] = (int16_t)(k < decimation ? k + 1 : 2 * decimation - 1 - k);
+		}
+	}
+	cic_gain = 1.0f / ((float)decimation * decimation * 32768.0f);
+
+	// Kaiser windowed sinc, cut off at 0.45 of the output rate. Row p is the
+	// filter for an output p/phases past an intermediate sample, ordered
+	// oldest sample first.
+	double midRate = (double)input_rate / decimation;
+	double cutoff = 0.45 * output_rate / midRate;
+	const double beta = 8.0;
+	double center = taps / 2.0;
+	coefficients.assign(phases * taps, 0.0f);
+	for (int p = 0; p < phases; p++) {
+		double sum = 0;
+		float* row = &coefficients[p * taps];
+		for (int i = 0; i < taps; i++) {
+			double t = (double)p / phases + (taps - 1 - i) - center;
+			double x = 2.0 * cutoff * t;
+			double sinc = fabs(x) < 1e-9 ? 1.0 : sin(sim_pi * x) / (sim_pi * x);
+			double w = t / center;
+			double kaiser = fabs(w) >= 1.0 ? 0.0 : besselI0(beta * sqrt(1.0 - w * w)) / besselI0(beta);
+			row[i] = (float)(sinc * kaiser);
+			sum += row[i];
+		}
+		// Unity gain at DC for every phase
+		for (int i = 0; i < taps; i++) { row[i] = (float)(row[i] / sum); }
+	}
+}
+
+// Processing
+// ----------
+
+void SimResampler::ProcessBlock() {
+	Decimate(input_end);
+	Resample();
+}
+
+void SimResampler::Flush() {
+	// Only whole stage 1 outputs can be filtered, the rest waits
+	int whole = history + ((input_pos - history) / decimation) * decimation;
+	if (whole == history) {
+		output_count = 0;
+		return;
+	}
+	int rest = input_pos - whole;
+	Decimate(whole);
+	Resample();
+	memmove(&input_l[history], &input_l[whole], rest * sizeof(int16_t));
+	memmove(&input_r[history], &input_r[whole], rest * sizeof(int16_t));
+	input_pos = history + rest;
+}
+
+// Stage 1: one intermediate sample per decimation inputs up to end
+void SimResampler::Decimate(int end) {
+	const int16_t* weights = cic_weights.data();
+	for (int pos = history + decimation; pos <= end; pos += decimation) {
+		int start = pos - window;
+		mid_l[mid_count] = dotInt16(&input_l[start], weights, window) * cic_gain;
+		mid_r[mid_count] = dotInt16(&input_r[start], weights, window) * cic_gain;
+		mid_count++;
+	}
+	// Keep the tail as history for the next block
+	memmove(&input_l[0], &input_l[end - history], history * sizeof(int16_t));
+	memmove(&input_r[0], &input_r[end - history], history * sizeof(int16_t));
+	input_pos = history;
+}
+
+// Stage 2: every output whose newest intermediate sample is available
+void SimResampler::Resample() {
+	int count = 0;
+	uint64_t step = (uint64_t)input_rate;
+	while (position < mid_count) {
+		int phase = (int)((position_frac * phases) / position_den);
+		int start = (int)position - (taps - 1);
+		float left, right;
+		dotFloat2(&mid_l[start], &mid_r[start], &coefficients[phase * taps], taps, left, right);
+		output[count * 2] = left;
+		output[count * 2 + 1] = right;
+		count++;
+
+		position_frac += step;
+		position += position_frac / position_den;
+		position_frac %= position_den;
+	}
+	output_count = count;
+
+	// Keep the last taps - 1 intermediate samples
+	int drop = mid_count - (taps - 1);
+	memmove(&mid_l[0], &mid_l[drop], (taps - 1) * sizeof(float));
+	memmove(&mid_r[0], &mid_r[drop], (taps - 1) * sizeof(float));
+	mid_count = taps - 1;
+	position -= drop;
+}
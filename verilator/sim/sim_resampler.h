@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Streaming stereo decimator from the core clock to the host audio rate.
+//
+// Clock() only stores the sample; each full block is filtered in two stages:
+//  1. a second-order CIC, done as a triangular FIR over int16 input, drops
+//     the rate by an integer factor to about 8x the output rate
+//  2. a polyphase windowed-sinc low-pass resamples that to the output rate,
+//     picking the phase for each output sample from an exact rational clock,
+//     so exactly outputRate samples come out of every inputRate clocks
+// Both inner loops are SSE2 dot products (scalar fallback elsewhere).
+struct SimResampler {
+public:
+	// Output of the last processed block, interleaved L/R in -1..1
+	std::vector<float> output;
+	int output_count;
+
+	SimResampler();
+	void Initialise(int inputRate, int outputRate);
+
+	// Returns true when a block was processed and output_count is set
+	inline bool Clock(int16_t left, int16_t right) {
+		input_l[input_pos] = left;
+		input_r[input_pos] = right;
+		if (++input_pos == input_end) {
+			ProcessBlock();
+			return true;
+		}
+		return false;
+	}
+	// Filter whatever is buffered (may produce no output)
+	void Flush();
+
+private:
+	static const int block_outputs = 64;	// Stage 1 outputs per block
+	static const int phases = 256;
+	static const int taps = 256;		// Stage 2 taps per phase
+
+	int input_rate;
+	int output_rate;
+
+	// Stage 1: input history + block, triangular CIC weights
+	int decimation;
+	int window;
+	int history;
+	int input_pos;
+	int input_end;
+	std::vector<int16_t> input_l;
+	std::vector<int16_t> input_r;
+	std::vector<int16_t> cic_weights;
+	float cic_gain;
+
+	// Stage 2: intermediate history + block, polyphase table
+	std::vector<float> mid_l;
+	std::vector<float> mid_r;
+	int mid_count;
+	std::vector<float> coefficients;	// phases rows of taps
+	int64_t position;			// Intermediate sample of the next output
+	uint64_t position_frac;			// ..plus position_frac / position_den
+	uint64_t position_den;
+
+	void BuildFilters();
+	void ProcessBlock();
+	void Decimate(int end);
+	void Resample();
+};
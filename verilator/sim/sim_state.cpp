@@ -0,0 +1,159 @@
+#include "sim_state.h"
+#include <stdio.h>
+#include <string.h>
+
+#include "gtkwave/lz4.h"
+#ifndef SIM_TRACE_FST
+// FST builds already compile LZ4 into verilated_fst_c.cpp
+#include "gtkwave/lz4.c"
+#endif
+
+// Memory streams
+// --------------
+
+SimStateWriter::SimStateWriter() {
+	data.reserve(256 * 1024);
+}
+
+void SimStateWriter::open() {
+	if (isOpen()) { return; }
+	data.clear();
+	m_cp = m_bufp;
+	m_isOpen = true;
+	header();
+}
+
+void SimStateWriter::close() {
+	if (!isOpen()) { return; }
+	trailer();
+	flush();
+	m_isOpen = false;
+}
+
+void SimStateWriter::flush() {
+	data.insert(data.end(), m_bufp, m_cp);
+	m_cp = m_bufp;
+}
+
+void SimStateReader::open(const vluint8_t* data, size_t size) {
+	if (isOpen()) { return; }
+	source = data;
+	source_size = size;
+	source_pos = 0;
+	m_cp = m_bufp;
+	m_endp = m_bufp;
+	m_isOpen = true;
+	header();
+}
+
+void SimStateReader::close() {
+	if (!isOpen()) { return; }
+	trailer();
+	m_isOpen = false;
+}
+
+void SimStateReader::fill() {
+	if (!isOpen()) { return; }
+	// Keep the unread bytes and top the buffer up from the source
+	size_t left = m_endp - m_cp;
+	memmove(m_bufp, m_cp, left);
+	m_cp = m_bufp;
+	m_endp = m_bufp + left;
+	size_t room = bufferSize() - left;
+	size_t take = source_size - source_pos < room ? source_size - source_pos : room;
+	memcpy(m_endp, source + source_pos, take);
+	source_pos += take;
+	m_endp += take;
+}
+
+// State files
+// -----------
+
+static const char state_magic[8] = { 'S', 'I', 'M', 'S', 'T', 'A', 'T', 'E' };
+
+bool SimState_WriteFile(const char* file, const std::vector<vluint8_t>& state) {
+	std::vector<char> block(LZ4_compressBound((int)state.size()));
+	vluint32_t sizes[2];
+	sizes[0] = (vluint32_t)state.size();
+	sizes[1] = (vluint32_t)LZ4_compress_default((const char*)state.data(), block.data(), (int)state.size(), (int)block.size());
+	if (sizes[1] == 0) { return false; }
+	FILE* f = fopen(file, "wb");
+	if (!f) { return false; }
+	vluint32_t version = SIM_STATE_VERSION;
+	bool ok = fwrite(state_magic, 1, 8, f) == 8 && fwrite(&version, sizeof(version), 1, f) == 1 &&
+		fwrite(sizes, sizeof(sizes), 1, f) == 1 && fwrite(block.data(), 1, sizes[1], f) == sizes[1];
+	return fclose(f) == 0 && ok;
+}
+
+bool SimState_ReadFile(const char* file, std::vector<vluint8_t>& state) {
+	FILE* f = fopen(file, "rb");
+	if (!f) { return false; }
+	char magic[8];
+	vluint32_t version;
+	vluint32_t sizes[2];
+	bool ok = fread(magic, 1, 8, f) == 8 && memcmp(magic, state_magic, 8) == 0 &&
+		fread(&version, sizeof(version), 1, f) == 1 && version == SIM_STATE_VERSION && fread(sizes, sizeof(sizes), 1, f) == 1;
+	std::vector<char> block;
+	if (ok) {
+		block.resize(sizes[1]);
+		ok = fread(block.data(), 1, sizes[1], f) == sizes[1];
+	}
+	fclose(f);
+	if (!ok) { return false; }
+	state.resize(sizes[0]);
+	return LZ4_decompress_safe(block.data(), (char*)state.data(), (int)sizes[1], (int)sizes[0]) == (int)sizes[0];
+}
+
+// Rewind buffer
+// -------------
+
+SimRewind::SimRewind(int slots) {
+	interval = 0;
+	count = 0;
+	oldest_frame = 0;
+	newest_frame = 0;
+	compressed_bytes = 0;
+	this->slots.resize(slots);
+	head = 0;
+}
+
+void SimRewind::Push(const std::vector<vluint8_t>& state, vluint64_t time, int frame) {
+	SimRewind_Snapshot& slot = slots[head];
+	int size = (int)state.size();
+	slot.data.resize(LZ4_compressBound(size));
+	slot.compressed_size = LZ4_compress_default((const char*)state.data(), slot.data.data(), size, (int)slot.data.size());
+	slot.size = size;
+	slot.time = time;
+	slot.frame = frame;
+	head = (head + 1) % (int)slots.size();
+	if (count < (int)slots.size()) { count++; }
+	UpdateStats();
+}
+
+bool SimRewind::Pop(std::vector<vluint8_t>& state) {
+	if (count == 0) { return false; }
+	head = (head + (int)slots.size() - 1) % (int)slots.size();
+	count--;
+	SimRewind_Snapshot& slot = slots[head];
+	state.resize(slot.size);
+	int got = LZ4_decompress_safe(slot.data.data(), (char*)state.data(), slot.compressed_size, slot.size);
+	UpdateStats();
+	return got == slot.size;
+}
+
+void SimRewind::Clear() {
+	count = 0;
+	UpdateStats();
+}
+
+void SimRewind::UpdateStats() {
+	size_t bytes = 0;
+	int n = count;
+	for (int i = 0; i < n; i++) {
+		const SimRewind_Snapshot& slot = slots[(head + (int)slots.size() - 1 - i) % (int)slots.size()];
+		bytes += slot.compressed_size;
+		if (i == 0) { newest_frame = slot.frame; }
+		if (i == n - 1) { oldest_frame = slot.frame; }
+	}
+	compressed_bytes = bytes;
+}
@@ -0,0 +1,79 @@
+#pragma once
+#include "verilated_heavy.h"
+#include "verilated_save.h"
+#include <atomic>
+#include <vector>
+
+// In-memory save states
+// ---------------------
+// VerilatedSerialize/VerilatedDeserialize streams over a byte vector instead
+// of a file, so the same << / >> code that saves the model to disk can take
+// a snapshot without touching the filesystem. The writer keeps its vector
+// between snapshots, so after the first one no memory is allocated.
+
+class SimStateWriter : public VerilatedSerialize {
+public:
+	std::vector<vluint8_t> data;
+
+	SimStateWriter();
+	virtual ~SimStateWriter() override { close(); }
+	void open();
+	virtual void close() override;
+	virtual void flush() override;
+};
+
+class SimStateReader : public VerilatedDeserialize {
+public:
+	SimStateReader() {}
+	virtual ~SimStateReader() override { close(); }
+	void open(const vluint8_t* data, size_t size);
+	virtual void close() override;
+	virtual void fill() override;
+
+private:
+	const vluint8_t* source;
+	size_t source_size;
+	size_t source_pos;
+};
+
+// Layout of the harness state saveState() writes around the model. Bump it
+// whenever a SaveState() in sim_clock.cpp, sim_bus.cpp or sim_video.cpp (or
+// saveState() itself) changes what it writes, so older files are refused.
+#define SIM_STATE_VERSION 1
+
+// State files: "SIMSTATE", SIM_STATE_VERSION, the uncompressed and LZ4 block
+// sizes, then the block. Files of another version are not read.
+bool SimState_WriteFile(const char* file, const std::vector<vluint8_t>& state);
+bool SimState_ReadFile(const char* file, std::vector<vluint8_t>& state);
+
+// Rewind buffer
+// -------------
+// Ring of LZ4 compressed snapshots taken every interval frames. Slots keep
+// their buffers when overwritten, so a full ring runs without allocating.
+struct SimRewind_Snapshot {
+	std::vector<char> data;	// LZ4 block
+	int compressed_size;
+	int size;
+	vluint64_t time;
+	int frame;
+};
+
+struct SimRewind {
+public:
+	int interval;			// Frames between snapshots, 0 to disable
+	std::atomic<int> count;		// Snapshots held
+	std::atomic<int> oldest_frame;
+	std::atomic<int> newest_frame;
+	std::atomic<size_t> compressed_bytes;
+
+	SimRewind(int slots);
+	void Push(const std::vector<vluint8_t>& state, vluint64_t time, int frame);
+	// Decompress the newest snapshot into state and drop it, false if empty
+	bool Pop(std::vector<vluint8_t>& state);
+	void Clear();
+
+private:
+	std::vector<SimRewind_Snapshot> slots;
+	int head;	// Next slot to write
+	void UpdateStats();
+};
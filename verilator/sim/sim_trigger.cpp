@@ -0,0 +1,266 @@
+#include "sim_trigger.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SIM_TRACE_FST
+#include "gtkwave/fstapi.h"
+#endif
+
+SimTrigger::SimTrigger(DebugConsole& c) {
+	console = &c;
+	pre_cycles = 1000;
+	post_cycles = 1000;
+	state = TRIGGER_OFF;
+	trigger_time = 0;
+	armed = false;
+	last_match = false;
+	remaining = 0;
+	ring_cycles = 0;
+	ring_pos = 0;
+	ring_fill = 0;
+}
+
+// Probes
+// ------
+
+void SimTrigger::AddProbe(const char* name, int bits, const CData* signal) {
+	probes.push_back({ name, bits, signal, 1, NULL });
+}
+
+void SimTrigger::AddProbe(const char* name, int bits, const SData* signal) {
+	probes.push_back({ name, bits, signal, 2, NULL });
+}
+
+void SimTrigger::AddProbe(const char* name, int bits, const IData* signal) {
+	probes.push_back({ name, bits, signal, 4, NULL });
+}
+
+void SimTrigger::AddProbe(const char* name, int bits, const SData* array, const CData* index) {
+	probes.push_back({ name, bits, array, 2, index });
+}
+
+uint32_t SimTrigger::Read(const SimTrigger_Probe& probe) {
+	int element = probe.index ? *probe.index : 0;
+	switch (probe.size) {
+	case 1: return ((const CData*)probe.signal)[element];
+	case 2: return ((const SData*)probe.signal)[element];
+	default: return ((const IData*)probe.signal)[element];
+	}
+}
+
+int SimTrigger::FindProbe(const std::string& name) {
+	for (size_t i = 0; i < probes.size(); i++) {
+		if (probes[i].name == name) { return (int)i; }
+	}
+	return -1;
+}
+
+// Arming
+// ------
+
+bool SimTrigger::ParseCondition(const char* condition) {
+	terms.clear();
+	std::string text = condition;
+	size_t start = 0;
+	while (start <= text.size()) {
+		size_t end = text.find_first_of(",&", start);
+		if (end == std::string::npos) { end = text.size(); }
+		std::string term = text.substr(start, end - start);
+		start = end + 1;
+
+		// Trim spaces
+		size_t first = term.find_first_not_of(' ');
+		if (first == std::string::npos) { continue; }
+		term = term.substr(first, term.find_last_not_of(' ') - first + 1);
+
+		size_t equals = term.find('=');
+		std::string name = term.substr(0, equals);
+		while (name.size() > 0 && name.back() == ' ') { name.pop_back(); }
+		int probe = FindProbe(name);
+		if (probe < 0) {
+			console->AddLog("Trigger: unknown signal '%s'", name.c_str());
+			return false;
+		}
+		uint32_t all = probes[probe].bits >= 32 ? 0xFFFFFFFF : (1u << probes[probe].bits) - 1;
+		SimTrigger_Term t = { probe, 0, all, false };
+		if (equals == std::string::npos) {
+			// Bare name: any bit set
+			t.nonzero = true;
+			terms.push_back(t);
+			continue;
+		}
+		const char* value = term.c_str() + equals + 1;
+		char* rest;
+		t.value = (uint32_t)strtoul(value, &rest, 0);
+		if (*rest == '/') { t.mask = (uint32_t)strtoul(rest + 1, &rest, 0) & all; }
+		if (rest == value || *rest != 0) {
+			console->AddLog("Trigger: bad value in '%s'", term.c_str());
+			return false;
+		}
+		t.value &= t.mask;
+		terms.push_back(t);
+	}
+	if (terms.size() == 0) {
+		console->AddLog("Trigger: empty condition");
+		return false;
+	}
+	return true;
+}
+
+bool SimTrigger::Arm(const char* condition, const char* file) {
+	if (!ParseCondition(condition)) {
+		Disarm();
+		return false;
+	}
+	if (pre_cycles < 0) { pre_cycles = 0; }
+	if (post_cycles < 0) { post_cycles = 0; }
+	filename = file;
+
+	ring_cycles = pre_cycles + post_cycles + 1;
+	ring.assign((size_t)ring_cycles * probes.size(), 0);
+	ring_time.assign(ring_cycles, 0);
+	ring_pos = 0;
+	ring_fill = 0;
+	remaining = -1;
+	last_match = true;	// A condition already true when arming does not fire
+	armed = true;
+	state = TRIGGER_ARMED;
+	console->AddLog("Trigger armed: %s (%d before, %d after)", condition, pre_cycles, post_cycles);
+	return true;
+}
+
+void SimTrigger::Disarm() {
+	armed = false;
+	if (state != TRIGGER_WRITTEN) { state = TRIGGER_OFF; }
+}
+
+void SimTrigger::Finish() {
+	if (armed && remaining >= 0) { Write(); }
+}
+
+// Recording
+// ---------
+
+void SimTrigger::Record(vluint64_t time) {
+	int count = (int)probes.size();
+	uint32_t* row = &ring[(size_t)ring_pos * count];
+	for (int i = 0; i < count; i++) { row[i] = Read(probes[i]); }
+	ring_time[ring_pos] = time;
+	if (++ring_pos == ring_cycles) { ring_pos = 0; }
+	if (ring_fill < ring_cycles) { ring_fill++; }
+
+	if (remaining >= 0) {
+		if (--remaining <= 0) { Write(); }
+		return;
+	}
+
+	// Fire on the cycle the condition becomes true
+	bool match = true;
+	for (const SimTrigger_Term& t : terms) {
+		uint32_t bits = row[t.probe] & t.mask;
+		match = match && (t.nonzero ? bits != 0 : bits == t.value);
+	}
+	if (match && !last_match) {
+		trigger_time = time;
+		remaining = post_cycles;
+		state = TRIGGER_CAPTURING;
+		console->AddLog("Trigger fired at %llu", (unsigned long long)time);
+		if (remaining == 0) { Write(); }
+	}
+	last_match = match;
+}
+
+void SimTrigger::Write() {
+	armed = false;
+#ifdef SIM_TRACE_FST
+	bool ok = WriteFST();
+#else
+	bool ok = WriteVCD();
+#endif
+	if (!ok) {
+		console->AddLog("Trigger: cannot write %s", filename.c_str());
+		state = TRIGGER_OFF;
+		return;
+	}
+	console->AddLog("Trigger: wrote %d cycles to %s", ring_fill, filename.c_str());
+	state = TRIGGER_WRITTEN;
+}
+
+// Trace output
+// ------------
+// Times are main_time (clk_sys cycles), the same units as the full trace.
+
+bool SimTrigger::WriteVCD() {
+	FILE* f = fopen(filename.c_str(), "w");
+	if (!f) { return false; }
+	int count = (int)probes.size();
+	fprintf(f, "$comment trigger at %llu $end\n", (unsigned long long)trigger_time);
+	fprintf(f, "$timescale 1ps $end\n");
+	fprintf(f, "$scope module trigger $end\n");
+	std::vector<std::string> codes(count);
+	for (int i = 0; i < count; i++) {
+		// Printable identifier codes, '!' upwards
+		int n = i;
+		do {
+			codes[i] += (char)('!' + n % 94);
+			n /= 94;
+		} while (n > 0);
+		fprintf(f, "$var wire %d %s %s $end\n", probes[i].bits, codes[i].c_str(), probes[i].name.c_str());
+	}
+	fprintf(f, "$upscope $end\n$enddefinitions $end\n");
+
+	int oldest = ring_fill < ring_cycles ? 0 : ring_pos;
+	const uint32_t* previous = NULL;
+	for (int r = 0; r < ring_fill; r++) {
+		int pos = (oldest + r) % ring_cycles;
+		const uint32_t* row = &ring[(size_t)pos * count];
+		fprintf(f, "#%llu\n", (unsigned long long)ring_time[pos]);
+		if (!previous) { fprintf(f, "$dumpvars\n"); }
+		for (int i = 0; i < count; i++) {
+			if (previous && previous[i] == row[i]) { continue; }
+			if (probes[i].bits == 1) {
+				fprintf(f, "%d%s\n", row[i] & 1, codes[i].c_str());
+				continue;
+			}
+			char bits[33];
+			for (int b = 0; b < probes[i].bits; b++) { bits[b] = ((row[i] >> (probes[i].bits - 1 - b)) & 1) ? '1' : '0'; }
+			bits[probes[i].bits] = 0;
+			fprintf(f, "b%s %s\n", bits, codes[i].c_str());
+		}
+		if (!previous) { fprintf(f, "$end\n"); }
+		previous = row;
+	}
+	fclose(f);
+	return true;
+}
+
+#ifdef SIM_TRACE_FST
+bool SimTrigger::WriteFST() {
+	void* ctx = fstWriterCreate(filename.c_str(), 1);
+	if (!ctx) { return false; }
+	int count = (int)probes.size();
+	fstWriterSetTimescale(ctx, -12);
+	fstWriterSetScope(ctx, FST_ST_VCD_MODULE, "trigger", NULL);
+	std::vector<fstHandle> handles(count);
+	for (int i = 0; i < count; i++) {
+		handles[i] = fstWriterCreateVar(ctx, FST_VT_VCD_WIRE, FST_VD_IMPLICIT, probes[i].bits, probes[i].name.c_str(), 0);
+	}
+	fstWriterSetUpscope(ctx);
+
+	int oldest = ring_fill < ring_cycles ? 0 : ring_pos;
+	const uint32_t* previous = NULL;
+	for (int r = 0; r < ring_fill; r++) {
+		int pos = (oldest + r) % ring_cycles;
+		const uint32_t* row = &ring[(size_t)pos * count];
+		fstWriterEmitTimeChange(ctx, ring_time[pos]);
+		for (int i = 0; i < count; i++) {
+			if (previous && previous[i] == row[i]) { continue; }
+			fstWriterEmitValueChange32(ctx, handles[i], probes[i].bits, row[i]);
+		}
+		previous = row;
+	}
+	fstWriterClose(ctx);
+	return true;
+}
+#endif
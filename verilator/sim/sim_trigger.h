@@ -0,0 +1,95 @@
+#pragma once
+#include "verilated_heavy.h"
+#include "sim_console.h"
+#include <atomic>
+#include <string>
+#include <vector>
+
+// Triggered trace
+// ---------------
+// Records a fixed list of probed signals into an in-memory ring once per
+// clk_sys cycle, and only writes a trace file when the trigger condition
+// becomes true: pre_cycles before the trigger up to post_cycles after it.
+// Recording is a handful of loads and stores per cycle, far cheaper than a
+// full tfp->dump() of the design.
+//
+// A condition is one or more "<probe>=<value>" terms joined by ',' or '&',
+// all of which must hold; "<probe>=<value>/<mask>" compares masked bits and
+// a bare "<probe>" means non-zero. Examples:
+//   unsupported             unsupported opcode fetched
+//   pc=0x0412               CPU at 0x0412
+//   ram_wr=1,ram_a=0x0900   memory write to 0x0900
+
+struct SimTrigger_Probe {
+	std::string name;
+	int bits;
+	const void* signal;
+	int size;		// Bytes per element: 1, 2 or 4
+	const CData* index;	// When set, signal is an array read at [*index]
+};
+
+struct SimTrigger_Term {
+	int probe;
+	uint32_t value;
+	uint32_t mask;
+	bool nonzero;	// Bare name, any masked bit set
+};
+
+enum SimTrigger_State {
+	TRIGGER_OFF,
+	TRIGGER_ARMED,		// Recording, waiting for the condition
+	TRIGGER_CAPTURING,	// Triggered, recording the post window
+	TRIGGER_WRITTEN
+};
+
+struct SimTrigger {
+public:
+	std::vector<SimTrigger_Probe> probes;
+	int pre_cycles;
+	int post_cycles;
+	std::string filename;
+	std::atomic<int> state;
+	vluint64_t trigger_time;
+
+	SimTrigger(DebugConsole& c);
+
+	void AddProbe(const char* name, int bits, const CData* signal);
+	void AddProbe(const char* name, int bits, const SData* signal);
+	void AddProbe(const char* name, int bits, const IData* signal);
+	void AddProbe(const char* name, int bits, const SData* array, const CData* index);
+
+	// Parse the condition and start recording, false on a bad condition
+	bool Arm(const char* condition, const char* file);
+	void Disarm();
+	// Write a capture cut short by the end of the run
+	void Finish();
+
+	// Called once per clk_sys cycle after eval
+	inline void Clock(vluint64_t time) {
+		if (armed) { Record(time); }
+	}
+
+private:
+	DebugConsole* console;
+	bool armed;
+	std::vector<SimTrigger_Term> terms;
+	bool last_match;
+	int remaining;
+
+	// Ring of ring_cycles rows of one value per probe
+	std::vector<uint32_t> ring;
+	std::vector<vluint64_t> ring_time;
+	int ring_cycles;
+	int ring_pos;
+	int ring_fill;
+
+	void Record(vluint64_t time);
+	uint32_t Read(const SimTrigger_Probe& probe);
+	int FindProbe(const std::string& name);
+	bool ParseCondition(const char* condition);
+	void Write();
+	bool WriteVCD();
+#ifdef SIM_TRACE_FST
+	bool WriteFST();
+#endif
+};
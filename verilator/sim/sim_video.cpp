@@ -1,9 +1,20 @@
 
 #include "sim_video.h"
+#include "sim_lockfree.h"
+#include "sim_hash.h"
+#include "verilated_save.h"
 
 #include <string>
+#include <string.h>
+#include <vector>
+#include <algorithm>
 
-#ifndef _MSC_VER
+#ifdef SIM_HEADLESS
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#elif !defined(_MSC_VER)
 #include "imgui_impl_sdl.h"
 #include "imgui_impl_opengl2.h"
 #include <stdio.h>
@@ -27,8 +38,12 @@ int output_rotate = 0;
 bool output_vflip = false;
 bool output_usevsync = 1;
 
+// Frames are drawn into output_ptr (the mailbox back buffer) by the sim thread
+// and picked up from the front buffer by the GUI thread once complete
+SimMailbox<uint32_t*> frames;
 uint32_t* output_ptr = NULL;
 unsigned int output_size;
+#ifndef SIM_HEADLESS
 #ifdef WIN32
 HWND hwnd;
 WNDCLASSEX wc;
@@ -36,11 +51,40 @@ WNDCLASSEX wc;
 SDL_Window* window;
 SDL_GLContext gl_context;
 GLuint tex;
+
+// Texture upload
+// --------------
+// The texture storage is allocated once in Initialise(). Each new frame is
+// written into the next of a ring of pixel buffer objects and copied to the
+// texture from there with glTexSubImage2D, so the transfer runs
+// asynchronously while the buffer written last frame may still be in use.
+// Without buffer object support it falls back to glTexSubImage2D from memory.
+typedef void (APIENTRYP SimGLGenBuffers)(GLsizei n, GLuint* buffers);
+typedef void (APIENTRYP SimGLDeleteBuffers)(GLsizei n, const GLuint* buffers);
+typedef void (APIENTRYP SimGLBindBuffer)(GLenum target, GLuint buffer);
+typedef void (APIENTRYP SimGLBufferData)(GLenum target, GLsizeiptr size, const void* data, GLenum usage);
+typedef void* (APIENTRYP SimGLMapBuffer)(GLenum target, GLenum access);
+typedef GLboolean (APIENTRYP SimGLUnmapBuffer)(GLenum target);
+SimGLGenBuffers simGlGenBuffers;
+SimGLDeleteBuffers simGlDeleteBuffers;
+SimGLBindBuffer simGlBindBuffer;
+SimGLBufferData simGlBufferData;
+SimGLMapBuffer simGlMapBuffer;
+SimGLUnmapBuffer simGlUnmapBuffer;
+
+const int pbo_count = 3;
+GLuint pbo[pbo_count];
+int pbo_index = 0;
+bool pbo_enabled = false;
 #endif
 ImTextureID texture_id;
 ImGuiIO io;
 
 ImVec4 clear_color = ImVec4(0.25f, 0.35f, 0.40f, 0.80f);
+#endif
+
+// Copy of the last frame sent to the texture, unchanged frames are not uploaded
+std::vector<uint32_t> uploaded_frame;
 
 int count_pixel;
 int count_line;
@@ -49,7 +93,6 @@ bool last_hblank;
 bool last_vblank;
 bool last_hsync;
 bool last_vsync;
-bool frame_ready = 1;
 
 // Statistics
 #ifdef WIN32
@@ -68,7 +111,25 @@ int stats_yMax;
 int stats_xMin;
 int stats_yMin;
 
-
+// Line buffer
+// -----------
+// Clock() only stores each pixel of the current line in line_buffer, indexed
+// by count_pixel. The line is written out on hsync (and vsync) through address
+// tables built for the current rotation and flip: the texture address of a
+// pixel is pixel_addr[count_pixel] + line_addr[count_line], with the clamping
+// already folded into both tables.
+std::vector<uint32_t> line_buffer;
+std::vector<uint32_t> pixel_addr;
+std::vector<uint32_t> line_addr;
+uint32_t* line_ptr;
+int line_last;	// Last slot in line_buffer, overflowing pixels are clamped to it
+int line_size;
+int line_end;
+int table_rotate;
+bool table_vflip;
+
+
+#ifndef SIM_HEADLESS
 #ifndef WIN32
 SDL_Renderer* renderer = NULL;
 SDL_Texture* texture = NULL;
@@ -176,6 +237,7 @@ LRESULT WINAPI WndProc(HWND hWnd, UINT msg, WPARAM wParam, LPARAM lParam)
 }
 #else
 #endif
+#endif
 
 SimVideo::SimVideo(int width, int height, int rotate)
 {
@@ -198,6 +260,56 @@ SimVideo::SimVideo(int width, int height, int rotate)
 	stats_yMax = -1000;
 	stats_xMin = 1000;
 	stats_yMin = 1000;
+	stats_bounds = false;
+	hash_frames = false;
+	frame_hash = 0;
+
+	// One slot either side of the visible area, as counts start at 1
+	line_size = std::max(output_width, output_height) + 2;
+	line_buffer.assign(line_size, 0);
+	line_ptr = line_buffer.data();
+	line_last = line_size - 1;
+	pixel_addr.assign(line_size, 0);
+	line_addr.assign(line_size, 0);
+	line_end = 0;
+	BuildAddressTables();
+}
+
+static inline int clampIndex(int v, int max) { return v < 0 ? 0 : (v > max - 1 ? max - 1 : v); }
+
+void SimVideo::BuildAddressTables() {
+	for (int i = 0; i < line_size; i++) {
+		int o = i - 1;
+		int w = output_width;
+		int h = output_height;
+		if (output_rotate == -1) {
+			// Rotate output by 90 degrees anti-clockwise: x from line, y from pixel
+			pixel_addr[i] = clampIndex(output_vflip ? o : h - o, h) * w;
+			line_addr[i] = clampIndex(o, w);
+		}
+		else if (output_rotate == 1) {
+			// Rotate output by 90 degrees clockwise
+			pixel_addr[i] = clampIndex(output_vflip ? h - o : o, h) * w;
+			line_addr[i] = clampIndex(w - o, w);
+		}
+		else {
+			pixel_addr[i] = clampIndex(o, w);
+			line_addr[i] = clampIndex(output_vflip ? h - o : o, h) * w;
+		}
+	}
+	table_rotate = output_rotate;
+	table_vflip = output_vflip;
+}
+
+// Write the buffered line to the output texture
+void SimVideo::CommitLine() {
+	if (line_end == 0) { return; }
+	if (table_rotate != output_rotate || table_vflip != output_vflip) { BuildAddressTables(); }
+	uint32_t base = line_addr[std::min(count_line, line_size - 1)];
+	for (int i = 0; i < line_end; i++) {
+		output_ptr[base + pixel_addr[i]] = line_buffer[i];
+	}
+	line_end = 0;
 }
 
 SimVideo::~SimVideo()
@@ -205,10 +317,33 @@ SimVideo::~SimVideo()
 
 }
 
+#ifdef SIM_HEADLESS
+int SimVideo::Initialise(const char* windowTitle) {
+
+	// No window or texture when headless, only the output buffers
+	AllocateFrames();
+	return 0;
+}
+
+void SimVideo::UpdateTexture() {
+	frames.Update();
+}
+
+void SimVideo::CleanUp() {
+	for (int b = 0; b < 3; b++) {
+		free(frames.buffers[b]);
+		frames.buffers[b] = NULL;
+	}
+	output_ptr = NULL;
+}
+
+void SimVideo::StartFrame() {
+}
+#else
 int SimVideo::Initialise(const char* windowTitle) {
 
 	// Setup pointers for video texture
-	output_ptr = (uint32_t*)malloc(output_size);
+	AllocateFrames();
 
 #ifdef WIN32
 	// Create application window
@@ -269,9 +404,6 @@ int SimVideo::Initialise(const char* windowTitle) {
 
 #endif
 
-	memset(output_ptr, 0xAA, output_size);
-
-
 #ifdef WIN32
 	// Upload texture to graphics system
 	D3D11_TEXTURE2D_DESC desc;
@@ -288,7 +420,7 @@ int SimVideo::Initialise(const char* windowTitle) {
 
 
 	D3D11_SUBRESOURCE_DATA subResource;
-	subResource.pSysMem = output_ptr;
+	subResource.pSysMem = frames.Front();
 	subResource.SysMemPitch = desc.Width * 4;
 	subResource.SysMemSlicePitch = 0;
 	g_pd3dDevice->CreateTexture2D(&desc, &subResource, &texture);
@@ -327,20 +459,46 @@ int SimVideo::Initialise(const char* windowTitle) {
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, output_width, output_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, output_ptr);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, output_width, output_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, frames.Front());
 	texture_id = (ImTextureID)tex;
+
+	// Pixel buffer objects for streaming uploads (core in OpenGL 2.1)
+	simGlGenBuffers = (SimGLGenBuffers)SDL_GL_GetProcAddress("glGenBuffers");
+	simGlDeleteBuffers = (SimGLDeleteBuffers)SDL_GL_GetProcAddress("glDeleteBuffers");
+	simGlBindBuffer = (SimGLBindBuffer)SDL_GL_GetProcAddress("glBindBuffer");
+	simGlBufferData = (SimGLBufferData)SDL_GL_GetProcAddress("glBufferData");
+	simGlMapBuffer = (SimGLMapBuffer)SDL_GL_GetProcAddress("glMapBuffer");
+	simGlUnmapBuffer = (SimGLUnmapBuffer)SDL_GL_GetProcAddress("glUnmapBuffer");
+	pbo_enabled = simGlGenBuffers && simGlDeleteBuffers && simGlBindBuffer && simGlBufferData && simGlMapBuffer && simGlUnmapBuffer;
+	if (pbo_enabled) {
+		simGlGenBuffers(pbo_count, pbo);
+		for (int i = 0; i < pbo_count; i++) {
+			simGlBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[i]);
+			simGlBufferData(GL_PIXEL_UNPACK_BUFFER, output_size, NULL, GL_STREAM_DRAW);
+		}
+		simGlBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
 #endif
+	uploaded_frame.assign(output_width * output_height, 0);
 	return 0;
 }
 
+// Returns true if frame differs from the one last uploaded, and remembers it
+static bool frameChanged(const uint32_t* frame) {
+	size_t bytes = uploaded_frame.size() * sizeof(uint32_t);
+	if (memcmp(uploaded_frame.data(), frame, bytes) == 0) { return false; }
+	memcpy(uploaded_frame.data(), frame, bytes);
+	return true;
+}
+
 void SimVideo::UpdateTexture() {
 
 #ifdef WIN32
 	// Update the texture!
 	// D3D11_USAGE_DEFAULT MUST be set in the texture description (somewhere above) for this to work.
 	// (D3D11_USAGE_DYNAMIC is for use with map / unmap.) ElectronAsh.
-	if (frame_ready) {
-		g_pd3dDeviceContext->UpdateSubresource(texture, 0, NULL, output_ptr, output_width * 4, 0);
+	if (frames.Update() && frameChanged(frames.Front())) {
+		g_pd3dDeviceContext->UpdateSubresource(texture, 0, NULL, frames.Front(), output_width * 4, 0);
 	}
 	// Rendering
 	ImGui::Render();
@@ -349,8 +507,24 @@ void SimVideo::UpdateTexture() {
 	ImGui_ImplDX11_RenderDrawData(ImGui::GetDrawData());
 	g_pSwapChain->Present(output_usevsync, 0); // Present without vsync
 #else
-	if (frame_ready) {
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, output_width, output_height, 0, GL_RGBA, GL_UNSIGNED_BYTE, output_ptr);
+	if (frames.Update() && frameChanged(frames.Front())) {
+		glBindTexture(GL_TEXTURE_2D, tex);
+		if (pbo_enabled) {
+			// Orphan the next buffer in the ring, fill it and upload from it
+			simGlBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo[pbo_index]);
+			simGlBufferData(GL_PIXEL_UNPACK_BUFFER, output_size, NULL, GL_STREAM_DRAW);
+			void* pixels = simGlMapBuffer(GL_PIXEL_UNPACK_BUFFER, GL_WRITE_ONLY);
+			if (pixels) {
+				memcpy(pixels, frames.Front(), output_size);
+				simGlUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+				glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, output_width, output_height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+			}
+			simGlBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			pbo_index = (pbo_index + 1) % pbo_count;
+		}
+		else {
+			glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, output_width, output_height, GL_RGBA, GL_UNSIGNED_BYTE, frames.Front());
+		}
 	}
 	// Rendering
 	ImGui::Render();
@@ -362,8 +536,6 @@ void SimVideo::UpdateTexture() {
 	SDL_GL_SwapWindow(window);
 #endif
 
-	frame_ready = 0;
-
 }
 
 void SimVideo::CleanUp() {
@@ -378,6 +550,8 @@ void SimVideo::CleanUp() {
 	UnregisterClass(wc.lpszClassName, wc.hInstance);
 #else
 	// Cleanup
+	if (pbo_enabled) { simGlDeleteBuffers(pbo_count, pbo); }
+	glDeleteTextures(1, &tex);
 	ImGui_ImplOpenGL2_Shutdown();
 	ImGui_ImplSDL2_Shutdown();
 	ImGui::DestroyContext();
@@ -399,6 +573,90 @@ void SimVideo::StartFrame() {
 #endif
 }
 
+#endif
+
+// Allocate the three mailbox buffers and start drawing into the back one
+void SimVideo::AllocateFrames() {
+	for (int b = 0; b < 3; b++) {
+		frames.buffers[b] = (uint32_t*)malloc(output_size);
+		memset(frames.buffers[b], 0xAA, output_size);
+	}
+	output_ptr = frames.Back();
+}
+
+// Write the last completed frame to a binary PPM file
+int SimVideo::SaveFrame(const char* filename) {
+	FILE* file = fopen(filename, "wb");
+	if (!file) { return 1; }
+	fprintf(file, "P6\n%d %d\n255\n", output_width, output_height);
+	for (int p = 0; p < output_width * output_height; p++) {
+		uint32_t colour = frames.Front()[p];
+		unsigned char rgb[3] = { (unsigned char)colour, (unsigned char)(colour >> 8), (unsigned char)(colour >> 16) };
+		fwrite(rgb, 1, 3, file);
+	}
+	fclose(file);
+	return 0;
+}
+
+void SimVideo::SaveState(VerilatedSerialize& os) {
+	os.write(&count_pixel, sizeof(count_pixel));
+	os.write(&count_line, sizeof(count_line));
+	os.write(&count_frame, sizeof(count_frame));
+	os << last_hblank << last_vblank << last_hsync << last_vsync;
+	os << frame_hash;
+	os.write(&line_end, sizeof(line_end));
+	os.write(line_buffer.data(), line_end * sizeof(uint32_t));
+	os.write(output_ptr, output_size);
+}
+
+bool SimVideo::LoadState(VerilatedDeserialize& os) {
+	os.read(&count_pixel, sizeof(count_pixel));
+	os.read(&count_line, sizeof(count_line));
+	os.read(&count_frame, sizeof(count_frame));
+	os >> last_hblank >> last_vblank >> last_hsync >> last_vsync;
+	os >> frame_hash;
+	os.read(&line_end, sizeof(line_end));
+	if (line_end < 0 || line_end > (int)line_buffer.size()) {
+		line_end = 0;
+		return false;
+	}
+	os.read(line_buffer.data(), line_end * sizeof(uint32_t));
+	os.read(output_ptr, output_size);
+	return true;
+}
+
+// Publish the frame drawn so far and start the next one
+void SimVideo::EndFrame() {
+	CommitLine();
+	if (hash_frames) { frame_hash = SimHash64(output_ptr, output_size); }
+	frames.Publish();
+	output_ptr = frames.Back();
+	count_frame++;
+	count_line = 0;
+#ifdef WIN32
+	GetSystemTime(&actualtime);
+	time_ms = (actualtime.wSecond * 1000) + actualtime.wMilliseconds;
+#else
+	struct timeval tv;
+	gettimeofday(&tv, NULL);
+	time_ms = (tv.tv_sec) * 1000 + (tv.tv_usec) / 1000; // convert tv_sec & tv_usec to millisecond
+#endif
+	stats_frameTime = time_ms - old_time;
+	old_time = time_ms;
+	stats_fps = (float)(1000.0 / stats_frameTime);
+}
+
+// Pixels 1 to count of the current line, then the next line, as Clock()
+// would leave them after a line of count pixels and its hsync
+void SimVideo::Line(const uint32_t* pixels, int count) {
+	count = std::min(count, line_last);
+	memcpy(line_ptr + 1, pixels, count * sizeof(uint32_t));
+	line_end = std::max(line_end, count + 1);
+	CommitLine();
+	count_line++;
+	count_pixel = 0;
+}
+
 void SimVideo::Clock(bool hblank, bool vblank, bool hsync, bool vsync, uint32_t colour) {
 
 	bool de = !(hblank || vblank);
@@ -406,7 +664,8 @@ void SimVideo::Clock(bool hblank, bool vblank, bool hsync, bool vsync, uint32_t
 	// Next line on rising hsync
 	if (!vblank) {
 		if (last_hsync && !hsync) {
-			// Increment line and reset pixel count
+			// Write out finished line, increment line and reset pixel count
+			CommitLine();
 			count_line++;
 			count_pixel = 0;
 		}
@@ -419,69 +678,25 @@ void SimVideo::Clock(bool hblank, bool vblank, bool hsync, bool vsync, uint32_t
 	}
 
 	// Reset on rising vsync
-	if (last_vsync && !vsync) {
-		frame_ready = 1;
-		count_frame++;
-		count_line = 0;
-#ifdef WIN32
-		GetSystemTime(&actualtime);
-		time_ms = (actualtime.wSecond * 1000) + actualtime.wMilliseconds;
-#else
-		struct timeval tv;
-		gettimeofday(&tv, NULL);
-		time_ms = (tv.tv_sec) * 1000 + (tv.tv_usec) / 1000; // convert tv_sec & tv_usec to millisecond
-#endif
-		stats_frameTime = time_ms - old_time;
-		old_time = time_ms;
-		stats_fps = (float)(1000.0 / stats_frameTime);
-	}
+	if (last_vsync && !vsync) { EndFrame(); }
 
-	// Only draw outside of blanks
+	// Only draw outside of blanks, into the line buffer
 	if (de) {
-
-		int ox = count_pixel - 1;
-		int oy = count_line - 1;
-		int x = ox, xs = output_width, y = oy;
-
-		if (output_rotate == -1) {
-			// Rotate output by 90 degrees clockwise
-			y = output_height - ox;
-			xs = output_width;
-			x = oy;
-		}
-		if (output_rotate == 1) {
-			// Rotate output by 90 degrees clockwise
-			y = ox;
-			xs = output_width;
-			x = output_width - oy;
-		}
-
-		if (output_vflip) {
-			y = output_height - y;
-		}
-
-		// Clamp values to stop access violations on texture
-		if (x < 0) { x = 0; }
-		if (x > output_width - 1) { x = output_width - 1; }
-		if (y < 0) { y = 0; }
-		if (y > output_height - 1) { y = output_height - 1; }
-
-		// Generate texture address
-		uint32_t vga_addr = (y * xs) + x;
-
-		// Write pixel to texture
-		output_ptr[vga_addr] = colour;
-
+		int slot = std::min(count_pixel, line_last);
+		line_ptr[slot] = colour;
+		line_end = std::max(line_end, slot + 1);
 	}
 
 	// Track bounds (debug)
-	if (count_pixel > stats_xMax) { stats_xMax = count_pixel; }
-	if (count_line > stats_yMax) { stats_yMax = count_line; }
-	if (count_pixel < stats_xMin) { stats_xMin = count_pixel; }
-	if (count_line < stats_yMin) { stats_yMin = count_line; }
+	if (stats_bounds) {
+		if (count_pixel > stats_xMax) { stats_xMax = count_pixel; }
+		if (count_line > stats_yMax) { stats_yMax = count_line; }
+		if (count_pixel < stats_xMin) { stats_xMin = count_pixel; }
+		if (count_line < stats_yMin) { stats_yMin = count_line; }
+	}
 
 	last_hblank = hblank;
 	last_vblank = vblank;
 	last_hsync = hsync;
 	last_vsync = vsync;
-}
\ No newline at end of file
+}
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <string>
-#ifndef _MSC_VER
+#include <stdint.h>
+#ifdef SIM_HEADLESS
+#elif !defined(_MSC_VER)
 #include "imgui_impl_sdl.h"
 #include "imgui_impl_opengl2.h"
 #else
@@ -12,6 +14,9 @@
 #include <tchar.h>
 #endif
 
+class VerilatedSerialize;
+class VerilatedDeserialize;
+
 struct SimVideo {
 public:
 
@@ -30,8 +35,14 @@ public:
 	int stats_xMin;
 	int stats_yMax;
 	int stats_yMin;
+	bool stats_bounds;	// Track stats_x/y Min/Max for every pixel (debug)
+
+	bool hash_frames;	// Hash every completed frame into frame_hash
+	uint64_t frame_hash;
 
+#ifndef SIM_HEADLESS
 	ImTextureID texture_id;
+#endif
 
 	SimVideo(int width, int height, int rotate);
 	~SimVideo();
@@ -39,5 +50,19 @@ public:
 	void CleanUp();
 	void StartFrame();
 	void Clock(bool hblank, bool vblank, bool hsync, bool vsync, uint32_t colour);
+	// Whole lines and the frame end, for engines that draw without a beam (SimFast)
+	void Line(const uint32_t* pixels, int count);
+	void EndFrame();
 	int Initialise(const char* windowTitle);
+	int SaveFrame(const char* filename);
+
+	// Beam position, sync history and the frame being drawn
+	void SaveState(VerilatedSerialize& os);
+	// False if the state does not fit this build (line longer than line_buffer)
+	bool LoadState(VerilatedDeserialize& os);
+
+private:
+	void AllocateFrames();
+	void BuildAddressTables();
+	void CommitLine();
 };
@@ -0,0 +1,143 @@
+#include "sim_wav.h"
+#include <string.h>
+
+static void writeLE(FILE* f, uint32_t value, int bytes) {
+	for (int b = 0; b < bytes; b++) { fputc((value >> (b * 8)) & 0xFF, f); }
+}
+
+SimWavWriter::SimWavWriter() {
+	file = NULL;
+	channels = 0;
+	sample_float = false;
+	data_size_pos = 0;
+	data_bytes = 0;
+	stopping = false;
+}
+
+SimWavWriter::~SimWavWriter() {
+	Close();
+}
+
+bool SimWavWriter::IsOpen() {
+	return file != NULL;
+}
+
+bool SimWavWriter::Open(const char* filename, int sampleRate, int channels, bool sampleFloat) {
+	Close();
+	file = fopen(filename, "wb");
+	if (!file) { return false; }
+	this->channels = channels;
+	sample_float = sampleFloat;
+	data_bytes = 0;
+	WriteHeader(sampleRate);
+
+	block.clear();
+	block.reserve(block_size);
+	stopping = false;
+	writer = std::thread(&SimWavWriter::WriterMain, this);
+	return true;
+}
+
+// RIFF header, float files also carry the extended fmt chunk and a fact chunk
+void SimWavWriter::WriteHeader(int sampleRate) {
+	int bytesPerSample = sample_float ? 4 : 2;
+	fwrite("RIFF", 1, 4, file);
+	writeLE(file, 0, 4);	// patched in Close()
+	fwrite("WAVE", 1, 4, file);
+
+	fwrite("fmt ", 1, 4, file);
+	writeLE(file, sample_float ? 18 : 16, 4);
+	writeLE(file, sample_float ? 3 : 1, 2);	// WAVE_FORMAT_IEEE_FLOAT / WAVE_FORMAT_PCM
+	writeLE(file, channels, 2);
+	writeLE(file, sampleRate, 4);
+	writeLE(file, sampleRate * channels * bytesPerSample, 4);
+	writeLE(file, channels * bytesPerSample, 2);
+	writeLE(file, bytesPerSample * 8, 2);
+	if (sample_float) {
+		writeLE(file, 0, 2);
+		fwrite("fact", 1, 4, file);
+		writeLE(file, 4, 4);
+		writeLE(file, 0, 4);	// patched in Close()
+	}
+
+	fwrite("data", 1, 4, file);
+	data_size_pos = ftell(file);
+	writeLE(file, 0, 4);	// patched in Close()
+}
+
+void SimWavWriter::Write(const float* samples) {
+	if (!file) { return; }
+	for (int c = 0; c < channels; c++) {
+		float s = samples[c];
+		if (s > 1.0f) { s = 1.0f; }
+		if (s < -1.0f) { s = -1.0f; }
+		if (sample_float) {
+			char bytes[4];
+			memcpy(bytes, &s, 4);
+			block.insert(block.end(), bytes, bytes + 4);
+		}
+		else {
+			int16_t v = (int16_t)(s * 32767.0f);
+			block.push_back((char)(v & 0xFF));
+			block.push_back((char)((v >> 8) & 0xFF));
+		}
+	}
+	if (block.size() >= block_size) { SubmitBlock(); }
+}
+
+// Hand the current block to the writer thread and continue in a spare one
+void SimWavWriter::SubmitBlock() {
+	std::lock_guard<std::mutex> lock(pending_mutex);
+	data_bytes += block.size();
+	pending.push_back(std::move(block));
+	if (spare.size() > 0) {
+		block = std::move(spare.back());
+		spare.pop_back();
+	}
+	else {
+		block = std::vector<char>();
+	}
+	block.clear();
+	block.reserve(block_size);
+	pending_ready.notify_one();
+}
+
+void SimWavWriter::WriterMain() {
+	std::unique_lock<std::mutex> lock(pending_mutex);
+	while (true) {
+		pending_ready.wait(lock, [this] { return stopping || pending.size() > 0; });
+		if (pending.size() == 0) { break; }
+		std::vector<char> next = std::move(pending.front());
+		pending.pop_front();
+		lock.unlock();
+		fwrite(next.data(), 1, next.size(), file);
+		lock.lock();
+		spare.push_back(std::move(next));
+	}
+}
+
+void SimWavWriter::Close() {
+	if (!file) { return; }
+	if (block.size() > 0) { SubmitBlock(); }
+	{
+		std::lock_guard<std::mutex> lock(pending_mutex);
+		stopping = true;
+		pending_ready.notify_one();
+	}
+	writer.join();
+
+	// Pad to an even chunk size, then patch the sizes
+	if (data_bytes & 1) { fputc(0, file); }
+	long end = ftell(file);
+	fseek(file, 4, SEEK_SET);
+	writeLE(file, (uint32_t)(end - 8), 4);
+	if (sample_float) {
+		fseek(file, data_size_pos - 8, SEEK_SET);
+		writeLE(file, (uint32_t)(data_bytes / (channels * 4)), 4);
+	}
+	fseek(file, data_size_pos, SEEK_SET);
+	writeLE(file, (uint32_t)data_bytes, 4);
+	fclose(file);
+	file = NULL;
+	spare.clear();
+}
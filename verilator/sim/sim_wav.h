@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+
+// WAV file writer. Samples are collected in large in-memory blocks and full
+// blocks are written by a background thread, so the sim thread never waits
+// on the disk. The RIFF and data sizes are patched in Close().
+struct SimWavWriter {
+public:
+	SimWavWriter();
+	~SimWavWriter();
+
+	// sampleFloat selects 32-bit IEEE float samples instead of 16-bit PCM
+	bool Open(const char* filename, int sampleRate, int channels, bool sampleFloat);
+	// One sample per channel, in the range -1..1
+	void Write(const float* samples);
+	void Close();
+	bool IsOpen();
+
+private:
+	static const size_t block_size = 256 * 1024;
+
+	FILE* file;
+	int channels;
+	bool sample_float;
+	long data_size_pos;
+	uint64_t data_bytes;
+
+	std::vector<char> block;
+	std::deque<std::vector<char>> pending;
+	std::vector<std::vector<char>> spare;
+	std::mutex pending_mutex;
+	std::condition_variable pending_ready;
+	std::thread writer;
+	bool stopping;
+
+	void WriteHeader(int sampleRate);
+	void SubmitBlock();
+	void WriterMain();
+};
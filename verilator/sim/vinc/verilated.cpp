@@ -1463,7 +1463,8 @@ void VL_WRITEF(const char* formatp, ...) VL_MT_SAFE {
     _vl_vsformat(t_output, formatp, ap);
     va_end(ap);
 
-	console.AddLog(t_output.c_str());
+	// Rate limited per $display, keyed by its format string
+	console.AddLogSite(formatp, "%s", t_output.c_str());
     //VL_PRINTF_MT("%s", t_output.c_str());
 }
 
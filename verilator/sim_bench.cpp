@@ -0,0 +1,349 @@
+#include "sim_video.h"
+#include "sim_resampler.h"
+#include "sim_logring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <math.h>
+
+// Sim component microbenchmarks
+// -----------------------------
+// Runs the C++ side of the sim on synthetic input, no Verilator model needed.
+//
+//   sim_bench [video|audio|log]
+//
+// log also checks every held line after each append and fails on a
+// corrupt one.
+
+// Synthetic Pixie-like timing: 112 clocks per line, 262 lines per frame
+const int bench_line_clocks = 112;
+const int bench_frame_lines = 262;
+const int bench_width = 128;
+const int bench_height = 128;
+
+struct BenchSignals {
+	bool hblank;
+	bool vblank;
+	bool hsync;
+	bool vsync;
+};
+
+BenchSignals benchTiming(int clock, int line) {
+	BenchSignals s;
+	s.hblank = clock < 32 || clock >= 96;
+	s.hsync = clock >= 100 && clock < 108;
+	s.vblank = line < 60 || line >= 188;
+	s.vsync = line >= 250 && line < 254;
+	return s;
+}
+
+// Per-pixel path of SimVideo::Clock before line buffering, kept as the
+// baseline for the video benchmark
+struct ReferenceVideo {
+	int output_width = bench_width;
+	int output_height = bench_height;
+	int output_rotate = 0;
+	bool output_vflip = false;
+	uint32_t* output_ptr;
+	int count_pixel = 0;
+	int count_line = 0;
+	int count_frame = 0;
+	bool last_hsync = 0;
+	bool last_vsync = 0;
+	int stats_xMax = -1000;
+	int stats_yMax = -1000;
+	int stats_xMin = 1000;
+	int stats_yMin = 1000;
+
+	__attribute__((noinline)) void Clock(bool hblank, bool vblank, bool hsync, bool vsync, uint32_t colour) {
+		bool de = !(hblank || vblank);
+		if (!vblank) {
+			if (last_hsync && !hsync) {
+				count_line++;
+				count_pixel = 0;
+			}
+			else if (de) {
+				count_pixel++;
+			}
+		}
+		if (last_vsync && !vsync) {
+			count_frame++;
+			count_line = 0;
+		}
+		if (de) {
+			int ox = count_pixel - 1;
+			int oy = count_line - 1;
+			int x = ox, xs = output_width, y = oy;
+			if (output_rotate == -1) {
+				y = output_height - ox;
+				xs = output_width;
+				x = oy;
+			}
+			if (output_rotate == 1) {
+				y = ox;
+				xs = output_width;
+				x = output_width - oy;
+			}
+			if (output_vflip) {
+				y = output_height - y;
+			}
+			if (x < 0) { x = 0; }
+			if (x > output_width - 1) { x = output_width - 1; }
+			if (y < 0) { y = 0; }
+			if (y > output_height - 1) { y = output_height - 1; }
+			uint32_t vga_addr = (y * xs) + x;
+			output_ptr[vga_addr] = colour;
+		}
+		if (count_pixel > stats_xMax) { stats_xMax = count_pixel; }
+		if (count_line > stats_yMax) { stats_yMax = count_line; }
+		if (count_pixel < stats_xMin) { stats_xMin = count_pixel; }
+		if (count_line < stats_yMin) { stats_yMin = count_line; }
+		last_hsync = hsync;
+		last_vsync = vsync;
+	}
+};
+
+// One frame of precomputed input so the harness cost stays out of the timing
+struct BenchFrame {
+	BenchSignals signals[bench_frame_lines * bench_line_clocks];
+	uint32_t colours[bench_frame_lines * bench_line_clocks];
+
+	BenchFrame() {
+		uint32_t colour = 0x12345678;
+		for (int line = 0; line < bench_frame_lines; line++) {
+			for (int clock = 0; clock < bench_line_clocks; clock++) {
+				colour = colour * 1664525 + 1013904223;
+				signals[line * bench_line_clocks + clock] = benchTiming(clock, line);
+				colours[line * bench_line_clocks + clock] = colour | 0xFF000000;
+			}
+		}
+	}
+};
+
+// Best of several runs, to keep scheduler noise out of the result
+const int bench_repeats = 5;
+
+template <typename T>
+double benchVideoRun(T& video, const BenchFrame& input, int frames) {
+	const int clocks = bench_frame_lines * bench_line_clocks;
+	double best = 0;
+	for (int repeat = 0; repeat < bench_repeats; repeat++) {
+		auto start = std::chrono::steady_clock::now();
+		for (int frame = 0; frame < frames; frame++) {
+			for (int i = 0; i < clocks; i++) {
+				const BenchSignals& s = input.signals[i];
+				video.Clock(s.hblank, s.vblank, s.hsync, s.vsync, input.colours[i]);
+			}
+		}
+		auto end = std::chrono::steady_clock::now();
+		double time = std::chrono::duration<double, std::nano>(end - start).count();
+		if (repeat == 0 || time < best) { best = time; }
+	}
+	return best;
+}
+
+int benchVideo() {
+	const int frames = 500;
+	double clocks = (double)frames * bench_line_clocks * bench_frame_lines;
+
+	static BenchFrame input;
+
+	printf("video: %d frames of %dx%d clocks\n", frames, bench_line_clocks, bench_frame_lines);
+	for (int rotate = -1; rotate <= 1; rotate++) {
+		ReferenceVideo reference;
+		std::string buffer(bench_width * bench_height * sizeof(uint32_t), 0);
+		reference.output_ptr = (uint32_t*)&buffer[0];
+		reference.output_rotate = rotate;
+		double before = benchVideoRun(reference, input, frames);
+
+		SimVideo video(bench_width, bench_height, rotate);
+		video.Initialise("");
+		double after = benchVideoRun(video, input, frames);
+		video.CleanUp();
+
+		printf("  rotate %2d  per-pixel: %6.2f ns/clock  line-buffered: %6.2f ns/clock  (%.2fx)\n",
+			rotate, before / clocks, after / clocks, after > 0 ? before / after : 0);
+	}
+	return 0;
+}
+
+// Audio
+// -----
+
+// Point sampling of SimAudio::Clock before the decimator, kept as the baseline
+struct ReferenceAudio {
+	uint64_t phase = 0;
+	int clock;
+	int rate;
+	std::vector<float> output = std::vector<float>(8192);
+	int count = 0;
+
+	ReferenceAudio(int clockFrequency, int sampleRate) : clock(clockFrequency), rate(sampleRate) {}
+
+	__attribute__((noinline)) void Clock(int16_t left, int16_t right) {
+		phase += rate;
+		if (phase >= (uint64_t)clock) {
+			phase -= clock;
+			output[count * 2] = left / 32768.0f;
+			output[count * 2 + 1] = right / 32768.0f;
+			count = (count + 1) & 4095;
+		}
+	}
+};
+
+// Same call shape as SimAudio::Clock, which is not inlined into the sim loop
+struct DecimatedAudio {
+	SimResampler resampler;
+	double sum = 0;
+
+	DecimatedAudio(int clockFrequency, int sampleRate) { resampler.Initialise(clockFrequency, sampleRate); }
+
+	__attribute__((noinline)) void Clock(int16_t left, int16_t right) {
+		if (resampler.Clock(left, right)) {
+			for (int i = 0; i < resampler.output_count * 2; i++) { sum += resampler.output[i]; }
+		}
+	}
+};
+
+// One period of a signal at the clock rate
+std::vector<int16_t> benchSignal(int clockFrequency, double frequency, bool square) {
+	int period = (int)(clockFrequency / frequency + 0.5);
+	std::vector<int16_t> signal(period);
+	for (int i = 0; i < period; i++) {
+		double s = sin(2.0 * 3.14159265358979323846 * i / period);
+		signal[i] = (int16_t)((square ? (s >= 0 ? 0.25 : -0.25) : 0.5 * s) * 32767.0);
+	}
+	return signal;
+}
+
+template <typename T>
+double benchAudioRun(int clockFrequency, const std::vector<int16_t>& signal) {
+	double best = 0;
+	for (int repeat = 0; repeat < bench_repeats; repeat++) {
+		T audio(clockFrequency, 44100);
+		size_t pos = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < clockFrequency; i++) {
+			audio.Clock(signal[pos], signal[pos]);
+			if (++pos == signal.size()) { pos = 0; }
+		}
+		auto end = std::chrono::steady_clock::now();
+		double time = std::chrono::duration<double, std::milli>(end - start).count();
+		if (repeat == 0 || time < best) { best = time; }
+	}
+	return best;
+}
+
+// Output level in dB relative to the input amplitude, skipping the warm up
+double benchAudioLevel(int clockFrequency, double frequency, bool decimated) {
+	std::vector<int16_t> signal = benchSignal(clockFrequency, frequency, false);
+	std::vector<float> output;
+	SimResampler resampler;
+	resampler.Initialise(clockFrequency, 44100);
+	ReferenceAudio reference(clockFrequency, 44100);
+	size_t pos = 0;
+	for (int i = 0; i < clockFrequency / 4; i++) {
+		if (decimated) {
+			if (resampler.Clock(signal[pos], signal[pos])) {
+				output.insert(output.end(), resampler.output.begin(), resampler.output.begin() + resampler.output_count * 2);
+			}
+		}
+		else {
+			int last = reference.count;
+			reference.Clock(signal[pos], signal[pos]);
+			if (reference.count != last) { output.push_back(reference.output[last * 2]); output.push_back(0); }
+		}
+		if (++pos == signal.size()) { pos = 0; }
+	}
+	double power = 0;
+	size_t samples = 0;
+	for (size_t i = 2048; i < output.size(); i += 2, samples++) { power += output[i] * output[i]; }
+	double rms = samples > 0 ? sqrt(power / samples) : 0;
+	return 20.0 * log10(rms / (0.5 / sqrt(2.0)) + 1e-12);
+}
+
+int benchAudio() {
+	printf("audio: 1 emulated second to 44100 Hz, 625 Hz square wave\n");
+	for (int clockFrequency : { 48000000, 1760000 }) {
+		std::vector<int16_t> signal = benchSignal(clockFrequency, 625, true);
+		double before = benchAudioRun<ReferenceAudio>(clockFrequency, signal);
+		double after = benchAudioRun<DecimatedAudio>(clockFrequency, signal);
+		printf("  clock %8d  point-sampled: %7.2f ms  decimated: %7.2f ms  (%.2f ns/clock)\n",
+			clockFrequency, before, after, after * 1e6 / clockFrequency);
+	}
+	printf("  level at 1760000 Hz clock  point-sampled / decimated\n");
+	for (double frequency : { 1000.0, 15000.0, 30000.0, 100000.0 }) {
+		printf("    %6.0f Hz tone  %7.1f dB / %7.1f dB\n", frequency,
+			benchAudioLevel(1760000, frequency, false), benchAudioLevel(1760000, frequency, true));
+	}
+	return 0;
+}
+
+// Log ring
+// --------
+
+// Append lines of random length, each filled with a letter from its number,
+// and check that every held line still has its length and text
+template <int MaxLines, int ArenaSize, int MaxLength>
+int benchLogCheck(SimLogRing<MaxLines, ArenaSize, MaxLength>& ring, int appends) {
+	static char text[MaxLength + 16];
+	srand(1);
+	for (int n = 0; n < appends; n++) {
+		int length = rand() % (MaxLength + 8);
+		memset(text, 'a' + n % 26, length);
+		ring.Append(text, length);
+		for (uint64_t number = ring.First(); number < ring.total; number++) {
+			const char* line = ring.Text(number);
+			int held = ring.Get(number).length;
+			if ((int)strlen(line) != held || (held > 0 && line[0] != 'a' + (int)(number % 26)) || (held > 0 && line[held - 1] != line[0])) {
+				printf("  corrupt line %llu after %d appends: offset %d length %d strlen %d\n", (unsigned long long)number,
+					n + 1, ring.Get(number).offset, held, (int)strlen(line));
+				return 1;
+			}
+		}
+	}
+	return 0;
+}
+
+int benchLog() {
+	int result = 0;
+	printf("log: random length lines, every held line checked after each append\n");
+	// Small arenas wrap every few lines, the line cap sees both full ring and full arena evictions
+	static SimLogRing<64, 4096, 256> small;
+	static SimLogRing<16, 8192, 1024> few;
+	int small_result = benchLogCheck(small, 200000);
+	int few_result = benchLogCheck(few, 100000);
+	printf("  64 lines / 4 KB:  %s\n", small_result ? "FAIL" : "pass");
+	printf("  16 lines / 8 KB:  %s\n", few_result ? "FAIL" : "pass");
+	result |= small_result | few_result;
+
+	// Append cost with the DebugConsole sizes
+	static SimLogRing<16384, 1 << 20, 1024> ring;
+	const int lines = 1000000;
+	const char* line = "Co-simulation warning at main_time 123456789: DMA OUT request not served";
+	int length = (int)strlen(line);
+	double best = 0;
+	for (int repeat = 0; repeat < bench_repeats; repeat++) {
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < lines; i++) { ring.Append(line, length); }
+		auto end = std::chrono::steady_clock::now();
+		double time = std::chrono::duration<double, std::nano>(end - start).count();
+		if (repeat == 0 || time < best) { best = time; }
+	}
+	printf("  append: %.2f ns/line\n", best / lines);
+	return result;
+}
+
+int main(int argc, char** argv) {
+	std::string bench = argc > 1 ? argv[1] : "all";
+	bool all = bench == "all";
+	int result = 0;
+	if (all || bench == "video") { result |= benchVideo(); }
+	if (all || bench == "audio") { result |= benchAudio(); }
+	if (all || bench == "log") { result |= benchLog(); }
+	return result;
+}
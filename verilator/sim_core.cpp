@@ -0,0 +1,409 @@
+#include "sim_core.h"
+#include "sim_hash.h"
+#include <string.h>
+
+// Debug console
+// -------------
+DebugConsole console;
+
+// HPS emulator
+// ------------
+SimBus bus(console);
+
+// Input handling
+// --------------
+SimInput input(12, console);
+
+// Video
+// -----
+SimVideo video(VGA_WIDTH, VGA_HEIGHT, VGA_ROTATE);
+
+// Verilog module
+// --------------
+Vtop* top = NULL;
+
+vluint64_t main_time = 0;	// Current simulation time.
+vluint64_t eval_count = 0;
+double sc_time_stamp() {	// Called by $time in Verilog.
+	return main_time;
+}
+
+// sim.v clocks the core once per clk_48 cycle, and the core does one
+// CPU/Pixie clock per clk_sys edge, so main_time runs at the Studio II's
+// 1.76 MHz whatever the port is called
+int clk_sys_freq = 1760000;
+SimClock clk_48(1);
+SimClock clk_24(2);
+
+// Trace logging
+// -------------
+SimTraceFile* tfp = new SimTraceFile; //Trace
+bool Trace = 0;
+char Trace_File[30] = SIM_TRACE_DEFAULT_FILE;
+SimTrigger trigger(console);
+#ifdef SIM_COSIM
+SimCosim cosim(console);
+#endif
+
+// Fast engine
+// -----------
+SimFast fast;
+bool fast_requested = false;
+
+// Save states
+// -----------
+SimRewind rewind_buffer(64);
+SimStateWriter rewind_writer;
+int rewind_frame = 0;
+
+// Audio
+// -----
+#ifndef DISABLE_AUDIO
+SimAudio audio(clk_sys_freq, false);
+#endif
+
+// Create core, attach trace and HPS bus
+void initialiseSim(int argc, char** argv) {
+
+	// Create core and initialise
+	top = new Vtop();
+	Verilated::commandArgs(argc, argv);
+
+	//Prepare for Dump Signals
+	Verilated::traceEverOn(true); //Trace
+	top->trace(tfp, 1);// atoi(Trace_Deep) );  // Trace 99 levels of hierarchy
+	if (Trace) tfp->open(Trace_File);//"simx.vcd"); //Trace
+
+#ifdef WIN32
+	// Attach debug console to the verilated code
+	Verilated::setDebug(console);
+#endif
+
+	// Attach bus
+	bus.ioctl_addr = &top->ioctl_addr;
+	bus.ioctl_index = &top->ioctl_index;
+	bus.ioctl_wait = &top->ioctl_wait;
+	bus.ioctl_download = &top->ioctl_download;
+	bus.ioctl_upload = &top->ioctl_upload;
+	bus.ioctl_wr = &top->ioctl_wr;
+	bus.ioctl_dout = &top->ioctl_dout;
+	bus.ioctl_din = &top->ioctl_din;
+	bus.ram = top->top__DOT__rcastudio__DOT__dpram__DOT__mem;
+	bus.ram_size = sizeof(top->top__DOT__rcastudio__DOT__dpram__DOT__mem);
+	bus.fast_load = true;
+	input.ps2_key = &top->ps2_key;
+	input.inputs_port = &top->inputs;
+	input.keypad_a = &top->top__DOT__rcastudio__DOT__playerA;
+	input.keypad_b = &top->top__DOT__rcastudio__DOT__playerB;
+
+	// Signals recorded by the triggered trace
+	trigger.AddProbe("pc", 16, top->top__DOT__rcastudio__DOT__cdp1802__DOT__R, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__P);
+	trigger.AddProbe("state", 4, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__state);
+	trigger.AddProbe("I", 4, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__I);
+	trigger.AddProbe("N", 4, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__N);
+	trigger.AddProbe("P", 4, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__P);
+	trigger.AddProbe("X", 4, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__X);
+	trigger.AddProbe("D", 8, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__D);
+	trigger.AddProbe("DF", 1, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__DF);
+	trigger.AddProbe("Q", 1, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__Q);
+	trigger.AddProbe("EF", 4, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__EF);
+	trigger.AddProbe("SC", 2, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__SC);
+	trigger.AddProbe("TPA", 1, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__TPA);
+	trigger.AddProbe("TPB", 1, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__TPB);
+	trigger.AddProbe("INT_N", 1, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__INT_N);
+	trigger.AddProbe("dma_in_req", 1, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__dma_in_req);
+	trigger.AddProbe("dma_out_req", 1, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__dma_out_req);
+	trigger.AddProbe("unsupported", 1, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__unsupported);
+	trigger.AddProbe("ram_a", 16, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_a);
+	trigger.AddProbe("ram_d", 8, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_d);
+	trigger.AddProbe("ram_q", 8, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_q);
+	trigger.AddProbe("ram_rd", 1, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_rd);
+	trigger.AddProbe("ram_wr", 1, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_wr);
+	trigger.AddProbe("io_n", 3, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__io_n);
+	trigger.AddProbe("io_out", 1, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__io_out);
+	trigger.AddProbe("io_inp", 1, &top->top__DOT__rcastudio__DOT__cdp1802__DOT__io_inp);
+	trigger.AddProbe("ioctl_download", 1, &top->top__DOT__rcastudio__DOT__ioctl_download);
+	trigger.AddProbe("ioctl_wr", 1, &top->top__DOT__rcastudio__DOT__ioctl_wr);
+	trigger.AddProbe("ioctl_addr", 16, &top->top__DOT__rcastudio__DOT__ioctl_addr);
+	trigger.AddProbe("pixie_DMAO", 1, &top->top__DOT__rcastudio__DOT__pixie_video__DOT__DMAO);
+	trigger.AddProbe("pixie_INT", 1, &top->top__DOT__rcastudio__DOT__pixie_video__DOT__INT);
+	trigger.AddProbe("pixie_EFx", 1, &top->top__DOT__rcastudio__DOT__pixie_video__DOT__EFx);
+	trigger.AddProbe("pixie_HSync", 1, &top->top__DOT__rcastudio__DOT__pixie_video__DOT__HSync);
+	trigger.AddProbe("pixie_VSync", 1, &top->top__DOT__rcastudio__DOT__pixie_video__DOT__VSync);
+
+	fast.keypad_a = &top->top__DOT__rcastudio__DOT__playerA;
+	fast.keypad_b = &top->top__DOT__rcastudio__DOT__playerB;
+	fast.video = &video;
+
+#ifdef SIM_COSIM
+	// Signals watched by the co-simulation
+	cosim.state = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__state;
+	cosim.clear_n = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__CLEAR_N;
+	cosim.ram_a = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_a;
+	cosim.ram_rd = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_rd;
+	cosim.ram_wr = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_wr;
+	cosim.ram_d = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_d;
+	cosim.ram_q = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_q;
+	cosim.ef = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__EF;
+	cosim.int_n = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__INT_N;
+	cosim.dma_out_req = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__dma_out_req;
+	cosim.io_din = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__io_din;
+	cosim.io_dout = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__io_dout;
+	cosim.io_n = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__io_n;
+	cosim.io_out = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__io_out;
+	cosim.R = top->top__DOT__rcastudio__DOT__cdp1802__DOT__R;
+	cosim.P = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__P;
+	cosim.X = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__X;
+	cosim.D = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__D;
+	cosim.DF = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__DF;
+	cosim.Q = &top->top__DOT__rcastudio__DOT__cdp1802__DOT__Q;
+#endif
+
+#ifndef DISABLE_AUDIO
+	audio.Initialise();
+#endif
+}
+
+// Queue a cartridge, .st2 files are split into their pages, anything else
+// is loaded as a raw image at 0x400
+void queueCartridge(const std::string& file) {
+	size_t dot = file.find_last_of('.');
+	std::string extension = dot == std::string::npos ? "" : file.substr(dot);
+	for (char& c : extension) { c = tolower(c); }
+	if (extension == ".st2") { bus.QueueST2(file); }
+	else { bus.QueueDownload(file, 1, true); }
+}
+
+// Reset simulation variables and clocks
+void resetSim() {
+	main_time = 0;
+	clk_48.Reset();
+	clk_24.Reset();
+}
+
+// Fast engine handoff
+// -------------------
+#define CPU(name) top->top__DOT__rcastudio__DOT__cdp1802__DOT__##name
+#define PIXIE(name) top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__##name
+
+void requestFast(bool enable) {
+	fast_requested = enable;
+}
+
+bool fastRequested() {
+	return fast_requested;
+}
+
+// Called after a rising edge: take over if the CPU is about to fetch and
+// the Pixie is in the handoff lines
+static bool fastFromRTL() {
+	if (CPU(state) != 1 || !CPU(CLEAR_N) || top->ioctl_download || bus.HasQueue()) { return false; }
+	SimFast_Pixie pixie;
+	pixie.vertical_pixel_counter = PIXIE(vertical_pixel_counter);
+	pixie.horizontal_pixel_counter = PIXIE(horizontal_pixel_counter);
+	pixie.video_state = PIXIE(video_state);
+	pixie.pixel_state = PIXIE(pixel_state);
+	pixie.line_repeat_counter = PIXIE(line_repeat_counter);
+	pixie.row_cache_counter = PIXIE(row_cache_counter);
+	pixie.video_byte_counter = PIXIE(video_byte_counter);
+	pixie.byte_counter = PIXIE(byte_counter);
+	pixie.nbit = PIXIE(nbit);
+	if (!fast.SetPixie(pixie) || !fast.InHandoffWindow()) { return false; }
+
+	for (int r = 0; r < 16; r++) { fast.R[r] = CPU(R)[r]; }
+	fast.P = CPU(P);
+	fast.X = CPU(X);
+	fast.D = CPU(D);
+	fast.DF = CPU(DF);
+	fast.Q = CPU(Q);
+	memcpy(fast.ram, top->top__DOT__rcastudio__DOT__dpram__DOT__mem, sizeof(fast.ram));
+	fast.keylatch = top->top__DOT__rcastudio__DOT__keylatch;
+	fast.active = true;
+	console.AddLog("Fast engine from main_time %llu, frame %d", (unsigned long long)main_time, video.count_frame);
+	return true;
+}
+
+// Called between instructions in the handoff lines: the RTL continues with
+// a FETCH from R(P)
+static void fastToRTL() {
+	for (int r = 0; r < 16; r++) { CPU(R)[r] = fast.R[r]; }
+	CPU(P) = fast.P;
+	CPU(X) = fast.X;
+	CPU(D) = fast.D;
+	CPU(DF) = fast.DF;
+	CPU(Q) = fast.Q;
+	CPU(state) = 1;
+	memcpy(top->top__DOT__rcastudio__DOT__dpram__DOT__mem, fast.ram, sizeof(fast.ram));
+	top->top__DOT__rcastudio__DOT__keylatch = fast.keylatch;
+
+	const SimFast_Pixie& pixie = fast.Pixie();
+	PIXIE(vertical_pixel_counter) = pixie.vertical_pixel_counter;
+	PIXIE(horizontal_pixel_counter) = pixie.horizontal_pixel_counter;
+	PIXIE(video_state) = pixie.video_state;
+	PIXIE(pixel_state) = pixie.pixel_state;
+	PIXIE(line_repeat_counter) = pixie.line_repeat_counter;
+	PIXIE(row_cache_counter) = pixie.row_cache_counter;
+	PIXIE(video_byte_counter) = pixie.video_byte_counter;
+	PIXIE(byte_counter) = pixie.byte_counter;
+	PIXIE(nbit) = pixie.nbit;
+	PIXIE(EFx) = pixie.EFx;
+	PIXIE(INT) = pixie.INT;
+	PIXIE(VSync) = pixie.VSync;
+	PIXIE(HSync) = pixie.HSync;
+	PIXIE(VBlank) = pixie.VBlank;
+	PIXIE(HBlank) = pixie.HBlank;
+	PIXIE(pixel_shift_reg) = 0;
+	memcpy(PIXIE(frame_buffer), fast.ram + 0x900, sizeof(PIXIE(frame_buffer)));
+	fast.active = false;
+	console.AddLog("RTL from main_time %llu, frame %d", (unsigned long long)main_time, video.count_frame);
+#ifdef SIM_COSIM
+	cosim.Resync();
+#endif
+}
+
+#undef CPU
+#undef PIXIE
+
+int verilate() {
+
+	if (!Verilated::gotFinish()) {
+
+		// Fast engine instead of the model, one instruction a call. A queued
+		// download goes back to the RTL, which loads it.
+		if (fast.active) {
+			input.BeforeEval(main_time);
+			main_time += fast.Step();
+			if ((!fast_requested || bus.HasQueue()) && fast.InHandoffWindow()) { fastToRTL(); }
+			return 1;
+		}
+
+		// Assert reset during startup
+		//if (main_time < initialReset) { top->reset = 1; }
+		// Deassert reset after startup
+		//if (main_time == initialReset) { top->reset = 0; }
+
+		// Clock dividers
+		clk_48.Tick();
+		clk_24.Tick();
+
+		// Set clocks in core
+		top->clk_48 = clk_48.clk;
+		top->clk_24 = clk_24.clk;
+
+		// Simulate both edges of fastest clock
+		if (clk_48.clk != clk_48.old) {
+
+			// System clock simulates HPS functions
+			if (clk_48.clk) {
+				input.BeforeEval(main_time);
+				bus.BeforeEval();
+			}
+			top->eval();
+			eval_count++;
+			if (Trace) {
+				if (!tfp->isOpen()) tfp->open(Trace_File);
+				tfp->dump(main_time); //Trace
+			}
+
+			// System clock simulates HPS functions
+			if (clk_48.clk) { bus.AfterEval(); }
+		}
+
+		if (clk_48.IsRising()) { trigger.Clock(main_time); }
+#ifdef SIM_COSIM
+		if (clk_48.IsRising()) { cosim.Clock(main_time); }
+#endif
+
+#ifndef DISABLE_AUDIO
+		if (clk_48.IsRising())
+		{
+			audio.Clock(top->AUDIO_L, top->AUDIO_R);
+		}
+#endif
+
+		// Output pixels on rising edge of pixel clock
+		if (clk_48.IsRising() && top->top__DOT__ce_pix) {
+			uint32_t colour = 0xFF000000 | top->VGA_B << 16 | top->VGA_G << 8 | top->VGA_R;
+			video.Clock(top->VGA_HB, top->VGA_VB, top->VGA_HS, top->VGA_VS, colour);
+		}
+
+		if (clk_48.IsRising()) {
+			main_time++;
+			if (fast_requested) { fastFromRTL(); }
+		}
+
+		// Rewind snapshots between cycles, once per interval frames
+		if (rewind_buffer.interval > 0 && video.count_frame != rewind_frame) {
+			rewind_frame = video.count_frame;
+			if (rewind_frame % rewind_buffer.interval == 0) {
+				saveState(rewind_writer);
+				rewind_buffer.Push(rewind_writer.data, main_time, rewind_frame);
+			}
+		}
+		return 1;
+	}
+
+	// Stop verilating and cleanup
+	top->final();
+	delete top;
+	exit(0);
+	return 0;
+}
+
+// Take a snapshot into os.data
+void saveState(SimStateWriter& os) {
+	os.open();
+	os << main_time;
+	clk_48.SaveState(os);
+	clk_24.SaveState(os);
+	bus.SaveState(os);
+	video.SaveState(os);
+	os << *top;
+	os.close();
+}
+
+bool loadState(const std::vector<vluint8_t>& state) {
+	SimStateReader os;
+	os.open(state.data(), state.size());
+	os >> main_time;
+	clk_48.LoadState(os);
+	clk_24.LoadState(os);
+	bus.LoadState(os);
+	if (!video.LoadState(os)) {
+		os.close();
+		return false;
+	}
+	os >> *top;
+	os.close();
+	rewind_frame = video.count_frame;
+	fast.active = false;
+#ifdef SIM_COSIM
+	cosim.Resync();
+#endif
+	return true;
+}
+
+uint64_t bootKey(const std::vector<std::string>& files, bool ioctl) {
+	// sim_core.cpp is rebuilt whenever Vtop.h changes, so its build time
+	// stands in for the model build, SIM_STATE_VERSION for the harness state
+	std::string build = std::string(__DATE__ " " __TIME__) + " " + std::to_string(sizeof(Vtop)) + " " + std::to_string(clk_sys_freq) +
+		" v" + std::to_string(SIM_STATE_VERSION) + (ioctl ? " ioctl" : " fast");
+	uint64_t key = SimHash64(build.data(), build.size());
+	for (const std::string& file : files) {
+		SimBus_Image image = SimBus_ReadImage(file);
+		if (image) { key = SimHash64(image->data(), image->size(), key); }
+		else { key = SimHash64(file.data(), file.size(), key); }
+	}
+	return key;
+}
+
+// Run until SimVideo sees the next vsync falling edge. Returns 1 on a
+// completed frame, 0 if max_ticks ran out first.
+int verilateFrame(int max_ticks) {
+	int frame = video.count_frame;
+	for (int tick = 0; tick < max_ticks; tick++) {
+		verilate();
+		if (video.count_frame != frame) { return 1; }
+	}
+	return 0;
+}
@@ -0,0 +1,116 @@
+#pragma once
+#include <verilated.h>
+#include "Vtop.h"
+
+#include "sim_console.h"
+#include "sim_bus.h"
+#include "sim_video.h"
+#include "sim_audio.h"
+#include "sim_input.h"
+#include "sim_clock.h"
+#include "sim_trigger.h"
+#include "sim_state.h"
+#include "sim_fast.h"
+#ifdef SIM_COSIM
+#include "sim_cosim.h"
+#endif
+
+
+// Shared simulation core, used by both the GUI (sim_main.cpp) and the
+// headless batch runner (sim_headless.cpp)
+
+// Video
+// -----
+#define VGA_WIDTH 128
+#define VGA_HEIGHT 128
+#define VGA_ROTATE 0  // 90 degrees anti-clockwise
+
+// Audio
+// -----
+// Define DISABLE_AUDIO to build without audio output
+
+// Verilog module
+// --------------
+extern Vtop* top;
+extern vluint64_t main_time;
+extern vluint64_t eval_count;	// top->eval() calls made by verilate()
+
+extern int clk_sys_freq;
+extern SimClock clk_48;
+extern SimClock clk_24;
+
+// HPS emulator, input and output
+// ------------------------------
+extern DebugConsole console;
+extern SimBus bus;
+extern SimInput input;
+extern SimVideo video;
+#ifndef DISABLE_AUDIO
+extern SimAudio audio;
+#endif
+
+// Trace logging
+// -------------
+// VCD by default, FST when built with TRACE=fst (see Makefile)
+#ifdef SIM_TRACE_FST
+#include <verilated_fst_c.h>
+typedef VerilatedFstC SimTraceFile;
+#define SIM_TRACE_NAME "FST"
+#define SIM_TRACE_DEFAULT_FILE "sim.fst"
+#define SIM_TRIGGER_DEFAULT_FILE "trigger.fst"
+#else
+#include <verilated_vcd_c.h> //VCD Trace
+typedef VerilatedVcdC SimTraceFile;
+#define SIM_TRACE_NAME "VCD"
+#define SIM_TRACE_DEFAULT_FILE "sim.vcd"
+#define SIM_TRIGGER_DEFAULT_FILE "trigger.vcd"
+#endif
+extern SimTraceFile* tfp;
+extern bool Trace;
+extern char Trace_File[30];
+
+// Triggered ring-buffer trace of the CPU, memory and video signals
+extern SimTrigger trigger;
+
+#ifdef SIM_COSIM
+// Lockstep check of the RTL CPU against the C++ reference model (COSIM=y)
+extern SimCosim cosim;
+#endif
+
+// Fast engine
+// -----------
+// While fast.active, verilate() runs one SimFast instruction instead of a
+// clock edge of the model. requestFast() asks for a switch either way; it is
+// made at the next instruction boundary in vertical blank, with no download
+// in flight, where the CPU registers, DPRAM, keypad latch and Pixie counters
+// can be copied across exactly.
+extern SimFast fast;
+void requestFast(bool enable);
+bool fastRequested();
+
+// Save states
+// -----------
+// Model plus harness state (main_time, clocks, bus downloads, video beam),
+// held in memory. The rewind buffer snapshots every rewind_buffer.interval frames.
+// They hold the model only, so take them with the fast engine off; loading
+// one stops the fast engine until the next switch point. loadState() returns
+// false on a state that does not fit this build; the core is then left
+// partly loaded and needs a reset or another state.
+extern SimRewind rewind_buffer;
+void saveState(SimStateWriter& os);
+bool loadState(const std::vector<vluint8_t>& state);
+
+// Key for a boot snapshot: the images loaded, how they were loaded, the
+// model build and SIM_STATE_VERSION, so a rebuilt model, a changed state
+// layout or another ROM never picks up a stale state
+uint64_t bootKey(const std::vector<std::string>& files, bool ioctl);
+
+// Upper bound of verilate() calls for one frame, so verilateFrame() still
+// returns while the video sync is not running (e.g. during reset)
+#define FRAME_MAX_TICKS 1000000
+
+void initialiseSim(int argc, char** argv);
+void resetSim();
+int verilate();
+int verilateFrame(int max_ticks = FRAME_MAX_TICKS);
+void queueCartridge(const std::string& file);
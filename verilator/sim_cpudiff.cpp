@@ -0,0 +1,329 @@
+#include "Vdiff_cdp1802.h"
+#include "Vdiff_cosmac.h"
+#include "verilated.h"
+#include "sim_cdp1802.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include <vector>
+
+// CPU differential runner
+// -----------------------
+// Verilates rtl/cdp1802.v (the core rcastudioii.sv uses) and rtl/cosmac.v
+// (the one it leaves commented out), each in its own small top with the
+// same memory image, and runs them side by side on the same stimulus:
+//
+// - compare: both cores step one instruction at a time. After each, R0-RF,
+//   P, X, D, DF, Q and the memory writes of the instruction must agree; the
+//   first mismatch is reported with both register sets.
+// - speed: each core runs from reset on its own for the same number of
+//   clock cycles, timed, and its cycles and instructions per second printed.
+//
+// The EF pins are driven from the count of instructions the core has
+// retired, not from time, so both cores see the same flags at the same
+// point of the program even where their cycle counts differ. Interrupt and
+// DMA requests are held inactive: cdp1802.v does not serve them.
+//
+//   sim_cpudiff [options] [cartridge]
+//     -r, --rom <file>           BIOS image loaded at 0 (default ./boot.rom)
+//     -n, --instructions <n>     instructions compared (default 1000000)
+//     -c, --cycles <n>           clock cycles timed per core (default 10000000)
+//
+// Exit code 2 when the cores disagree. Built by "make cpudiff".
+
+const char* rom_file = "./boot.rom";
+const char* cart_file = NULL;
+vluint64_t max_instructions = 1000000;
+vluint64_t speed_cycles = 10000000;
+
+double sc_time_stamp() {	// Called by $time in Verilog.
+	return 0;
+}
+
+// A core gets stuck (cosmac.v idles on 00) rather than diverging
+const int max_instruction_cycles = 64;
+
+std::vector<uint8_t> image(4096, 0);
+
+// Stimulus
+// --------
+
+// EF pins before instruction n, bit 0 is EF1: EF1 raised for a stretch of
+// every 256 instructions as the Pixie does around the display, EF2 high as
+// on the Studio II, and now and then a key on EF3 or EF4
+uint8_t stimulus(vluint64_t n) {
+	uint8_t ef = 0x2;
+	if ((n & 0xFF) < 16) { ef |= 0x1; }
+	if (((n >> 12) & 7) == 3) { ef |= 0x4; }
+	if (((n >> 12) & 7) == 5) { ef |= 0x8; }
+	return ef;
+}
+
+bool loadFile(const char* file, size_t offset) {
+	FILE* f = fopen(file, "rb");
+	if (!f) { return false; }
+	size_t size = fread(&image[offset], 1, image.size() - offset, f);
+	fclose(f);
+	return size > 0;
+}
+
+// Cores
+// -----
+
+struct DiffWrite {
+	uint16_t address;
+	uint8_t value;
+};
+
+// Architectural state at an instruction boundary, and what the instruction
+// that led to it wrote
+struct DiffState {
+	uint16_t R[16];
+	uint8_t P;
+	uint8_t X;
+	uint8_t D;
+	bool DF;
+	bool Q;
+	std::vector<DiffWrite> writes;
+};
+
+// Both tops have the same ports, see sim_cpudiff_cdp1802.v
+template <class T> struct DiffCore {
+	const char* name;
+	T* top;
+	vluint64_t cycles;
+	vluint64_t instructions;
+
+	DiffCore(const char* n) {
+		name = n;
+		top = new T();
+		cycles = 0;
+		instructions = 0;
+	}
+
+	void Clock() {
+		top->clk = 1;
+		top->eval();
+		top->clk = 0;
+		top->eval();
+		cycles++;
+	}
+
+	// Load the image with reset held, then run to the first fetch
+	bool Reset() {
+		top->reset = 1;
+		top->ef = stimulus(0);
+		for (size_t a = 0; a < image.size(); a++) {
+			top->load_wr = 1;
+			top->load_a = (uint16_t)a;
+			top->load_d = image[a];
+			Clock();
+		}
+		top->load_wr = 0;
+		for (int i = 0; i < 4; i++) { Clock(); }
+		top->reset = 0;
+		cycles = 0;
+		instructions = 0;
+		for (int i = 0; i < max_instruction_cycles && !top->fetch; i++) { Clock(); }
+		return top->fetch;
+	}
+
+	// Run from one fetch to the next, false when none comes
+	bool Step(DiffState* state) {
+		if (state) { state->writes.clear(); }
+		top->ef = stimulus(instructions);
+		for (int i = 0; i < max_instruction_cycles; i++) {
+			Clock();
+			if (top->fetch) {
+				instructions++;
+				if (state) { Read(*state); }
+				return true;
+			}
+			if (top->wr && state) { state->writes.push_back({ top->wr_a, top->wr_d }); }
+		}
+		return false;
+	}
+
+	void Read(DiffState& state) {
+		for (int r = 0; r < 16; r++) { state.R[r] = (top->regs[r / 2] >> ((r & 1) * 16)) & 0xFFFF; }
+		state.P = top->p;
+		state.X = top->x;
+		state.D = top->d;
+		state.DF = top->df;
+		state.Q = top->q;
+	}
+};
+
+DiffCore<Vdiff_cdp1802> cdp1802("cdp1802.v");
+DiffCore<Vdiff_cosmac> cosmac("cosmac.v");
+
+// Compare
+// -------
+
+struct DiffTrace {
+	vluint64_t n;
+	uint16_t pc;
+	uint8_t opcode;
+};
+
+const int history_size = 16;
+DiffTrace history[history_size];
+int history_pos = 0;
+
+bool sameState(const DiffState& a, const DiffState& b) {
+	bool same = a.P == b.P && a.X == b.X && a.D == b.D && a.DF == b.DF && a.Q == b.Q;
+	for (int r = 0; r < 16; r++) { same = same && a.R[r] == b.R[r]; }
+	same = same && a.writes.size() == b.writes.size();
+	for (size_t i = 0; same && i < a.writes.size(); i++) {
+		same = a.writes[i].address == b.writes[i].address && a.writes[i].value == b.writes[i].value;
+	}
+	return same;
+}
+
+std::string writesText(const DiffState& state) {
+	std::string line;
+	char text[32];
+	for (const DiffWrite& w : state.writes) {
+		snprintf(text, sizeof(text), " %04X=%02X", w.address, w.value);
+		line += text;
+	}
+	return line.empty() ? " -" : line;
+}
+
+void report(vluint64_t n, const char* reason, const DiffState& a, const DiffState& b) {
+	const DiffTrace& last = history[(history_pos + history_size - 1) % history_size];
+	printf("Mismatch at instruction %llu: %s\n", (unsigned long long)n, reason);
+	if (n > 0) { printf("  instruction %04X: %02X %s\n", last.pc, last.opcode, SimCDP1802_Mnemonic(last.opcode)); }
+	printf("        %-9s %-9s\n", cdp1802.name, cosmac.name);
+	printf("  P     %X         %X%s\n", a.P, b.P, a.P != b.P ? "  *" : "");
+	printf("  X     %X         %X%s\n", a.X, b.X, a.X != b.X ? "  *" : "");
+	printf("  D     %02X        %02X%s\n", a.D, b.D, a.D != b.D ? "  *" : "");
+	printf("  DF    %d         %d%s\n", a.DF, b.DF, a.DF != b.DF ? "  *" : "");
+	printf("  Q     %d         %d%s\n", a.Q, b.Q, a.Q != b.Q ? "  *" : "");
+	for (int r = 0; r < 16; r++) {
+		printf("  R%X    %04X      %04X%s\n", r, a.R[r], b.R[r], a.R[r] != b.R[r] ? "  *" : "");
+	}
+	printf("  %s writes:%s\n", cdp1802.name, writesText(a).c_str());
+	printf("  %s writes: %s\n", cosmac.name, writesText(b).c_str());
+	printf("  Last instructions:\n");
+	for (int i = 0; i < history_size; i++) {
+		const DiffTrace& h = history[(history_pos + i) % history_size];
+		if (h.n == 0) { continue; }
+		printf("    %04X: %02X %s\n", h.pc, h.opcode, SimCDP1802_Mnemonic(h.opcode));
+	}
+}
+
+// Lockstep run; the memory image follows cdp1802.v's writes so the opcode
+// of each instruction can be shown
+bool compare() {
+	DiffState a, b;
+	memset(history, 0, sizeof(history));
+	if (!cdp1802.Reset() || !cosmac.Reset()) {
+		printf("Mismatch at reset: %s does not reach a fetch\n", cdp1802.top->fetch ? cosmac.name : cdp1802.name);
+		return false;
+	}
+	cdp1802.Read(a);
+	cosmac.Read(b);
+	if (!sameState(a, b)) {
+		report(0, "state after reset", a, b);
+		return false;
+	}
+
+	std::vector<uint8_t> memory = image;
+	for (vluint64_t n = 1; n <= max_instructions; n++) {
+		uint16_t pc = a.R[a.P];
+		history[history_pos] = { n, pc, memory[pc & 0xFFF] };
+		history_pos = (history_pos + 1) % history_size;
+
+		bool stepped_a = cdp1802.Step(&a);
+		bool stepped_b = cosmac.Step(&b);
+		if (!stepped_a || !stepped_b) {
+			char reason[96];
+			snprintf(reason, sizeof(reason), "%s did not finish the instruction in %d cycles",
+				stepped_a ? cosmac.name : cdp1802.name, max_instruction_cycles);
+			report(n, reason, a, b);
+			return false;
+		}
+		if (!sameState(a, b)) {
+			report(n, "architectural state", a, b);
+			return false;
+		}
+		for (const DiffWrite& w : a.writes) {
+			uint16_t address = w.address & 0xFFF;
+			if (address >= 0x800 && address < 0xA00) { memory[address] = w.value; }
+		}
+	}
+	printf("Agree on %llu instructions (%llu / %llu cycles)\n", (unsigned long long)max_instructions,
+		(unsigned long long)cdp1802.cycles, (unsigned long long)cosmac.cycles);
+	return true;
+}
+
+// Speed
+// -----
+
+template <class T> void speed(DiffCore<T>& core) {
+	if (!core.Reset()) {
+		printf("%-9s  does not reach a fetch after reset\n", core.name);
+		return;
+	}
+	auto start = std::chrono::steady_clock::now();
+	while (core.cycles < speed_cycles) {
+		core.top->ef = stimulus(core.instructions);
+		core.Clock();
+		if (core.top->fetch) { core.instructions++; }
+	}
+	auto end = std::chrono::steady_clock::now();
+	double seconds = std::chrono::duration<double>(end - start).count();
+	printf("%-9s  %llu cycles in %.3f s  %7.3f Mcycles/s  %7.3f Minstructions/s  (%.2f cycles/instruction)\n",
+		core.name, (unsigned long long)core.cycles, seconds, core.cycles / seconds / 1e6,
+		core.instructions / seconds / 1e6, core.instructions ? (double)core.cycles / core.instructions : 0.0);
+}
+
+void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [options] [cartridge]\n", name);
+	fprintf(stderr, "  -r, --rom <file>           BIOS image loaded at 0 (default ./boot.rom)\n");
+	fprintf(stderr, "  -n, --instructions <n>     instructions compared (default 1000000)\n");
+	fprintf(stderr, "  -c, --cycles <n>           clock cycles timed per core (default 10000000)\n");
+}
+
+bool parseArgs(int argc, char** argv) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if ((arg == "-r" || arg == "--rom") && hasValue) { rom_file = argv[++i]; }
+		else if ((arg == "-n" || arg == "--instructions") && hasValue) { max_instructions = strtoull(argv[++i], NULL, 0); }
+		else if ((arg == "-c" || arg == "--cycles") && hasValue) { speed_cycles = strtoull(argv[++i], NULL, 0); }
+		else if (arg[0] == '-') { return false; }
+		else { cart_file = argv[i]; }
+	}
+	return true;
+}
+
+int main(int argc, char** argv) {
+	Verilated::commandArgs(argc, argv);
+	if (!parseArgs(argc, argv)) {
+		usage(argv[0]);
+		return 1;
+	}
+	if (!loadFile(rom_file, 0)) {
+		fprintf(stderr, "Cannot load ROM %s\n", rom_file);
+		return 1;
+	}
+	// Cartridges load at 0x400, as the ioctl download places index 1
+	if (cart_file && !loadFile(cart_file, 0x400)) {
+		fprintf(stderr, "Cannot load cartridge %s\n", cart_file);
+		return 1;
+	}
+
+	bool agree = compare();
+	printf("Speed, %llu cycles each:\n", (unsigned long long)speed_cycles);
+	speed(cdp1802);
+	speed(cosmac);
+
+	cdp1802.top->final();
+	cosmac.top->final();
+	return agree ? 0 : 2;
+}
@@ -0,0 +1,93 @@
+`timescale 1ns/1ns
+// CPU differential top for cdp1802.v, see sim_cpudiff.cpp
+//
+// The core with the Studio II memory as rcastudioii.sv wires it: 4K of
+// synchronous DPRAM, CPU writes only reaching 0x800-0x9FF. The harness
+// fills the memory through the load port while reset is held and drives
+// the EF pins itself. Interrupt and DMA requests are held inactive (the
+// core does not serve them).
+
+module diff_cdp1802(
+   input clk,
+   input reset,
+   input [3:0] ef,
+
+   input        load_wr,
+   input [11:0] load_a,
+   input [7:0]  load_d,
+
+   output         fetch,
+   output [255:0] regs,
+   output [3:0]   p,
+   output [3:0]   x,
+   output [7:0]   d,
+   output         df,
+   output         q,
+
+   output        wr,
+   output [15:0] wr_a,
+   output [7:0]  wr_d
+);
+
+   wire        ram_rd;
+   wire        ram_wr;
+   wire [15:0] ram_a;
+   wire [7:0]  ram_d;
+   reg  [7:0]  ram_q;
+   wire [1:0]  SC;
+   wire [7:0]  io_dout;
+   wire [2:0]  io_n;
+   wire        io_inp;
+   wire        io_out;
+   wire        unsupported;
+
+   cdp1802 core (
+      .CLOCK        (clk),
+      .CLEAR_N      (~reset),
+      .Q            (q),
+      .EF           (ef),
+      .WAIT_N       (1'b0),
+      .INT_N        (1'b1),
+      .dma_in_req   (1'b0),
+      .dma_out_req  (1'b0),
+      .SC           (SC),
+      .io_din       (8'h00),
+      .io_dout      (io_dout),
+      .io_n         (io_n),
+      .io_inp       (io_inp),
+      .io_out       (io_out),
+      .unsupported  (unsupported),
+      .ram_rd       (ram_rd),
+      .ram_wr       (ram_wr),
+      .ram_a        (ram_a),
+      .ram_q        (ram_q),
+      .ram_d        (ram_d)
+   );
+
+   reg [7:0] mem[0:4095];
+   wire cpu_wr = ram_wr && ram_a[11:0] >= 12'h800 && ram_a[11:0] < 12'hA00;
+   always @(posedge clk) begin
+      ram_q <= mem[ram_a[11:0]];
+      if (load_wr) mem[load_a] <= load_d;
+      else if (cpu_wr) mem[ram_a[11:0]] <= ram_d;
+   end
+
+   // Architectural state, valid when fetch is high (the previous
+   // instruction has finished)
+   assign fetch = core.state == 4'd1;
+   genvar i;
+   generate
+      for (i = 0; i < 16; i = i + 1) begin : reg_file
+         assign regs[i*16 +: 16] = core.R[i];
+      end
+   endgenerate
+   assign p = core.P;
+   assign x = core.X;
+   assign d = core.D;
+   assign df = core.DF;
+
+   assign wr = ram_wr;
+   assign wr_a = ram_a;
+   assign wr_d = ram_d;
+
+endmodule
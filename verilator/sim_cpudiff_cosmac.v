@@ -0,0 +1,84 @@
+`timescale 1ns/1ns
+// CPU differential top for cosmac.v, see sim_cpudiff.cpp
+//
+// Same memory map and load port as sim_cpudiff_cdp1802.v. cosmac.v latches
+// data_in in the cycle it puts the address out, so the memory is read
+// asynchronously here (on the synchronous DPRAM of rcastudioii.sv it would
+// see every byte a cycle late). clear is active high and wait_req is held
+// low to run; interrupt and DMA requests are held inactive.
+
+module diff_cosmac(
+   input clk,
+   input reset,
+   input [3:0] ef,
+
+   input        load_wr,
+   input [11:0] load_a,
+   input [7:0]  load_d,
+
+   output         fetch,
+   output [255:0] regs,
+   output [3:0]   p,
+   output [3:0]   x,
+   output [7:0]   d,
+   output         df,
+   output         q,
+
+   output        wr,
+   output [15:0] wr_a,
+   output [7:0]  wr_d
+);
+
+   wire        mem_read;
+   wire        mem_write;
+   wire [15:0] address;
+   wire [7:0]  data_out;
+   wire [7:0]  data_in;
+   wire [2:0]  io_port;
+   wire [1:0]  sc;
+
+   cosmac core (
+      .clk          (clk),
+      .clk_enable   (1'b1),
+      .clear        (reset),
+      .dma_in_req   (1'b0),
+      .dma_out_req  (1'b0),
+      .int_req      (1'b0),
+      .wait_req     (1'b0),
+      .ef           (ef),
+      .data_in      (data_in),
+      .data_out     (data_out),
+      .address      (address),
+      .mem_read     (mem_read),
+      .mem_write    (mem_write),
+      .io_port      (io_port),
+      .q_out        (q),
+      .sc           (sc)
+   );
+
+   reg [7:0] mem[0:4095];
+   wire cpu_wr = mem_write && address[11:0] >= 12'h800 && address[11:0] < 12'hA00;
+   assign data_in = mem[address[11:0]];
+   always @(posedge clk) begin
+      if (load_wr) mem[load_a] <= load_d;
+      else if (cpu_wr) mem[address[11:0]] <= data_out;
+   end
+
+   // Architectural state, valid when fetch is high
+   assign fetch = core.state == 4'b0011;
+   genvar i;
+   generate
+      for (i = 0; i < 16; i = i + 1) begin : reg_file
+         assign regs[i*16 +: 16] = {core.r_high[i], core.r_low[i]};
+      end
+   endgenerate
+   assign p = core.p;
+   assign x = core.x;
+   assign d = core.d;
+   assign df = core.df;
+
+   assign wr = mem_write;
+   assign wr_a = address;
+   assign wr_d = data_out;
+
+endmodule
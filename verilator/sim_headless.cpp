@@ -0,0 +1,429 @@
+#include "sim_core.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <chrono>
+#include <vector>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+// Headless batch runner
+// ---------------------
+// Runs the core without any SDL/GL/ImGui so it can be used on the build farm.
+//
+//   Vtop_headless [options] [cartridge]
+//     -r, --rom <file>         BIOS image loaded at index 0 (default ./boot.rom)
+//     -c, --cycles <n>         stop after n core cycles
+//     -f, --frames <n>         stop after n video frames
+//     -o, --out <dir>          output directory (default ./headless_out)
+//     -s, --save-every <n>     also save every n-th frame (default: last frame only)
+//     -i, --ioctl              load through the cycle-accurate ioctl download
+//     -H, --hashes <file>      write "frame main_time hash" for every frame
+//     -g, --golden <file>      compare against a hash file, stop at the first
+//                              divergence (exit code 2)
+//     -w, --wav <file>         write the audio output to a WAV file
+//     -m, --movie <file>       replay an input movie (default budget: to its
+//                              last event)
+//     -l, --latency            report cycles from each input change to the
+//                              first frame that differs
+//     -t, --trace <file>       write a trace (VCD, or FST when built with
+//                              TRACE=fst)
+//     -T, --trigger <cond>     record a ring of signals and write only the
+//                              cycles around the first time cond holds, e.g.
+//                              unsupported, pc=0x412, ram_wr=1,ram_a=0x900
+//         --trigger-window <pre>:<post>
+//                              cycles kept before/after (default 1000:1000)
+//     -b, --boot-cache <dir>   start from a snapshot of the boot keyed by the
+//                              ROM, cartridge and model build; without one,
+//                              boot normally and save it at --boot-frames
+//         --boot-frames <n>    frame the boot snapshot is taken at (default 120)
+//     -F, --fast <n>           run the first n frames on the fast functional
+//                              engine, then hand over to the RTL (their frame
+//                              hashes are not comparable with RTL ones)
+//         --cosim-requests     COSIM=y builds: stop at a DMA or interrupt
+//                              request the RTL CPU leaves unserved (by
+//                              default only the first of each is logged)
+//
+// COSIM=y builds check every instruction of the RTL CPU against the C++
+// reference model and stop at the first mismatch (exit code 3).
+
+const char* rom_file = "./boot.rom";
+const char* cart_file = NULL;
+const char* out_dir = "./headless_out";
+vluint64_t max_cycles = 0;
+int max_frames = 0;
+int save_every = 0;
+bool ioctl_load = false;
+const char* hash_file = NULL;
+const char* golden_file = NULL;
+const char* wav_file = NULL;
+const char* movie_file = NULL;
+bool report_latency = false;
+const char* trigger_condition = NULL;
+const char* boot_cache = NULL;
+int boot_frames = 120;
+bool cosim_requests = false;
+int fast_frames = 0;
+
+// Golden frame hashes
+// -------------------
+struct FrameHash {
+	int frame;
+	vluint64_t time;
+	uint64_t hash;
+};
+std::vector<FrameHash> golden;
+size_t golden_next = 0;
+
+bool loadGolden(const char* file) {
+	FILE* f = fopen(file, "r");
+	if (!f) { return false; }
+	char line[256];
+	while (fgets(line, sizeof(line), f)) {
+		if (line[0] == '#') { continue; }
+		int frame;
+		unsigned long long time, hash;
+		if (sscanf(line, "%d %llu %llx", &frame, &time, &hash) == 3) {
+			golden.push_back({ frame, (vluint64_t)time, (uint64_t)hash });
+		}
+	}
+	fclose(f);
+	return true;
+}
+
+void usage(const char* name) {
+	fprintf(stderr, "Usage: %s [options] [cartridge]\n", name);
+	fprintf(stderr, "  -r, --rom <file>         BIOS image loaded at index 0 (default ./boot.rom)\n");
+	fprintf(stderr, "  -c, --cycles <n>         stop after n core cycles\n");
+	fprintf(stderr, "  -f, --frames <n>         stop after n video frames\n");
+	fprintf(stderr, "  -o, --out <dir>          output directory (default ./headless_out)\n");
+	fprintf(stderr, "  -s, --save-every <n>     also save every n-th frame\n");
+	fprintf(stderr, "  -i, --ioctl              load through the cycle-accurate ioctl download\n");
+	fprintf(stderr, "  -H, --hashes <file>      write \"frame main_time hash\" for every frame\n");
+	fprintf(stderr, "  -g, --golden <file>      compare against a hash file, stop at the first divergence\n");
+	fprintf(stderr, "  -w, --wav <file>         write the audio output to a WAV file\n");
+	fprintf(stderr, "  -m, --movie <file>       replay an input movie (default budget: to its last event)\n");
+	fprintf(stderr, "  -l, --latency            report cycles from each input change to the first frame that differs\n");
+	fprintf(stderr, "  -t, --trace <file>       write a " SIM_TRACE_NAME " trace\n");
+	fprintf(stderr, "  -T, --trigger <cond>     write only the cycles around cond to <out>/" SIM_TRIGGER_DEFAULT_FILE "\n");
+	fprintf(stderr, "      --trigger-window <pre>:<post>  cycles kept before/after the trigger (default 1000:1000)\n");
+	fprintf(stderr, "  -b, --boot-cache <dir>   start from a cached boot snapshot, or save one\n");
+	fprintf(stderr, "      --boot-frames <n>    frame the boot snapshot is taken at (default 120)\n");
+	fprintf(stderr, "  -F, --fast <n>           run the first n frames on the fast engine, then the RTL\n");
+#ifdef SIM_COSIM
+	fprintf(stderr, "      --cosim-requests     stop at unserved DMA and interrupt requests\n");
+#endif
+}
+
+bool parseArgs(int argc, char** argv) {
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool hasValue = (i + 1 < argc);
+		if ((arg == "-r" || arg == "--rom") && hasValue) { rom_file = argv[++i]; }
+		else if ((arg == "-c" || arg == "--cycles") && hasValue) { max_cycles = strtoull(argv[++i], NULL, 0); }
+		else if ((arg == "-f" || arg == "--frames") && hasValue) { max_frames = atoi(argv[++i]); }
+		else if ((arg == "-o" || arg == "--out") && hasValue) { out_dir = argv[++i]; }
+		else if ((arg == "-s" || arg == "--save-every") && hasValue) { save_every = atoi(argv[++i]); }
+		else if (arg == "-i" || arg == "--ioctl") { ioctl_load = true; }
+		else if ((arg == "-H" || arg == "--hashes") && hasValue) { hash_file = argv[++i]; }
+		else if ((arg == "-g" || arg == "--golden") && hasValue) { golden_file = argv[++i]; }
+		else if ((arg == "-w" || arg == "--wav") && hasValue) { wav_file = argv[++i]; }
+		else if ((arg == "-m" || arg == "--movie") && hasValue) { movie_file = argv[++i]; }
+		else if (arg == "-l" || arg == "--latency") { report_latency = true; }
+		else if ((arg == "-t" || arg == "--trace") && hasValue) {
+			snprintf(Trace_File, sizeof(Trace_File), "%s", argv[++i]);
+			Trace = 1;
+		}
+		else if ((arg == "-T" || arg == "--trigger") && hasValue) { trigger_condition = argv[++i]; }
+		else if (arg == "--trigger-window" && hasValue) {
+			if (sscanf(argv[++i], "%d:%d", &trigger.pre_cycles, &trigger.post_cycles) != 2) { return false; }
+		}
+		else if ((arg == "-b" || arg == "--boot-cache") && hasValue) { boot_cache = argv[++i]; }
+		else if (arg == "--boot-frames" && hasValue) { boot_frames = atoi(argv[++i]); }
+		else if ((arg == "-F" || arg == "--fast") && hasValue) { fast_frames = atoi(argv[++i]); }
+		else if (arg == "--cosim-requests") { cosim_requests = true; }
+		else if (arg[0] == '+') { continue; } // Verilator plusargs
+		else if (arg[0] != '-' && !cart_file) { cart_file = argv[i]; }
+		else { return false; }
+	}
+	return max_cycles > 0 || max_frames > 0 || golden_file || movie_file;
+}
+
+void saveFrame(const char* name) {
+	std::string path = std::string(out_dir) + "/" + name;
+	if (video.SaveFrame(path.c_str())) {
+		console.AddLog("Cannot write frame %s", path.c_str());
+	}
+}
+
+int main(int argc, char** argv, char** env) {
+
+	if (!parseArgs(argc, argv)) {
+		usage(argv[0]);
+		return 1;
+	}
+	mkdir(out_dir, 0755);
+
+	// Golden run defaults to the length of the golden file
+	if (golden_file) {
+		if (!loadGolden(golden_file)) {
+			fprintf(stderr, "Cannot read golden file %s\n", golden_file);
+			return 1;
+		}
+		if (max_cycles == 0 && max_frames == 0 && golden.size() > 0) { max_frames = golden.back().frame; }
+	}
+	FILE* hashes = NULL;
+	if (hash_file) {
+		hashes = fopen(hash_file, "w");
+		if (!hashes) {
+			fprintf(stderr, "Cannot write hash file %s\n", hash_file);
+			return 1;
+		}
+		fprintf(hashes, "# rom: %s\n# cartridge: %s\n# frame main_time hash\n", rom_file, cart_file ? cart_file : "-");
+	}
+
+	// Create core, attach trace and bus
+#ifndef DISABLE_AUDIO
+	if (wav_file) {
+		audio.save_to_file = true;
+		audio.filename = wav_file;
+	}
+#endif
+	initialiseSim(argc, argv);
+	input.Initialise();
+	video.Initialise("");
+	video.hash_frames = hashes || golden_file || report_latency;
+#ifdef SIM_COSIM
+	cosim.check_requests = cosim_requests;
+#endif
+	if (fast_frames > 0) { requestFast(true); }
+
+	if (trigger_condition) {
+		std::string path = std::string(out_dir) + "/" SIM_TRIGGER_DEFAULT_FILE;
+		if (!trigger.Arm(trigger_condition, path.c_str())) {
+			fprintf(stderr, "Bad trigger condition %s\n", trigger_condition);
+			return 1;
+		}
+	}
+
+	bus.fast_load = !ioctl_load;
+	bus.QueueDownload(rom_file, 0, true);
+	if (cart_file) { queueCartridge(cart_file); }
+
+	// Movie run defaults to its last event
+	if (movie_file) {
+		if (!input.ReplayMovie(movie_file)) {
+			fprintf(stderr, "Cannot read movie %s\n", movie_file);
+			return 1;
+		}
+		if (max_cycles == 0 && max_frames == 0) { max_cycles = input.movie.size() > 0 ? input.movie.back().time + 1 : 1; }
+	}
+
+	// Boot snapshot: start from it when cached, otherwise save it on the way
+	std::string boot_path;
+	const char* boot_result = "-";
+	double boot_load_ms = 0;
+	if (boot_cache) {
+		mkdir(boot_cache, 0755);
+		std::vector<std::string> files = { rom_file };
+		if (cart_file) { files.push_back(cart_file); }
+		char name[64];
+		snprintf(name, sizeof(name), "boot_%016llx.state", (unsigned long long)bootKey(files, ioctl_load));
+		boot_path = std::string(boot_cache) + "/" + name;
+
+		auto load_start = std::chrono::steady_clock::now();
+		std::vector<vluint8_t> state;
+		if (SimState_ReadFile(boot_path.c_str(), state)) {
+			if (!loadState(state)) {
+				fprintf(stderr, "Boot snapshot %s does not fit this build, delete it\n", boot_path.c_str());
+				return 1;
+			}
+			boot_load_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - load_start).count();
+			boot_result = "cached";
+			if (movie_file && input.movie.size() > 0 && input.movie.front().time < main_time) {
+				fprintf(stderr, "Movie %s starts before the boot snapshot in %s\n", movie_file, boot_path.c_str());
+				return 1;
+			}
+			// Golden hashes up to the snapshot frame are already behind us
+			while (golden_next < golden.size() && golden[golden_next].frame <= video.count_frame) { golden_next++; }
+		}
+		else { boot_result = "cold"; }
+	}
+
+	// Run simulation until the budget is used up. Rates cover this run only,
+	// not the cycles and frames a cached boot snapshot restored
+	vluint64_t start_time = main_time;
+	vluint64_t start_evals = eval_count;
+	int start_frame = video.count_frame;
+	auto start = std::chrono::steady_clock::now();
+	auto frame_start = start;
+	double frame_ms_max = 0;
+	int last_frame = video.count_frame;
+	bool diverged = false;
+
+	// Input to pixel latency: from an input change to the next frame whose
+	// hash differs from the one before it
+	vluint64_t latency_event = input.last_event_time;
+	bool latency_pending = false;
+	uint64_t latency_hash = 0;
+	int latency_count = 0;
+	vluint64_t latency_min = 0, latency_max = 0, latency_total = 0;
+	while (!diverged && (max_cycles == 0 || main_time < max_cycles) && (max_frames == 0 || video.count_frame < max_frames)) {
+		verilate();
+#ifdef SIM_COSIM
+		if (cosim.diverged) { break; }
+#endif
+		if (video.count_frame != last_frame) {
+			last_frame = video.count_frame;
+
+			// Wall time of each emulated frame (first one includes the boot load)
+			auto now = std::chrono::steady_clock::now();
+			double frame_ms = std::chrono::duration<double, std::milli>(now - frame_start).count();
+			if (last_frame > 1 && frame_ms > frame_ms_max) { frame_ms_max = frame_ms; }
+			frame_start = now;
+
+			// Fast-forward done, back to the RTL at the next switch point
+			if (fast_frames > 0 && last_frame >= fast_frames && fastRequested()) { requestFast(false); }
+
+			// Save the boot snapshot unless input has already reached the core
+			if (boot_cache && last_frame == boot_frames && strcmp(boot_result, "cold") == 0) {
+				if (input.last_event_time != 0 || input.movie_pos > 0) { console.AddLog("Input before frame %d, boot snapshot not saved", boot_frames); }
+				else if (fast.active) { console.AddLog("Fast engine running at frame %d, boot snapshot not saved", boot_frames); }
+				else {
+					SimStateWriter state;
+					saveState(state);
+					if (SimState_WriteFile(boot_path.c_str(), state.data)) {
+						boot_result = "saved";
+						console.AddLog("Boot snapshot saved to %s", boot_path.c_str());
+					}
+					else { console.AddLog("Cannot write boot snapshot %s", boot_path.c_str()); }
+				}
+			}
+
+			if (report_latency) {
+				if (input.last_event_time != latency_event) {
+					latency_event = input.last_event_time;
+					latency_pending = true;
+				}
+				else if (latency_pending && video.frame_hash != latency_hash) {
+					vluint64_t latency = main_time - latency_event;
+					printf("latency: input at %llu, frame %d at %llu, %llu cycles\n", (unsigned long long)latency_event,
+						last_frame, (unsigned long long)main_time, (unsigned long long)latency);
+					if (latency_count == 0 || latency < latency_min) { latency_min = latency; }
+					if (latency > latency_max) { latency_max = latency; }
+					latency_total += latency;
+					latency_count++;
+					latency_pending = false;
+				}
+				latency_hash = video.frame_hash;
+			}
+
+			// Frame hash stream and golden comparison
+			if (hashes) { fprintf(hashes, "%d %llu %016llx\n", last_frame, (unsigned long long)main_time, (unsigned long long)video.frame_hash); }
+			if (golden_next < golden.size()) {
+				const FrameHash& expected = golden[golden_next++];
+				if (expected.frame != last_frame || expected.time != main_time || expected.hash != video.frame_hash) {
+					fprintf(stderr, "Divergence at frame %d main_time %llu: hash %016llx, golden frame %d main_time %llu hash %016llx\n",
+						last_frame, (unsigned long long)main_time, (unsigned long long)video.frame_hash,
+						expected.frame, (unsigned long long)expected.time, (unsigned long long)expected.hash);
+					diverged = true;
+				}
+			}
+
+			video.UpdateTexture();
+			if (save_every > 0 && (last_frame % save_every) == 0) {
+				char name[32];
+				snprintf(name, sizeof(name), "frame_%06d.ppm", last_frame);
+				saveFrame(name);
+			}
+		}
+	}
+	auto end = std::chrono::steady_clock::now();
+	trigger.Finish();
+	double seconds = std::chrono::duration<double>(end - start).count();
+	if (hashes) { fclose(hashes); }
+	if (golden_file && !diverged && golden_next < golden.size()) {
+		fprintf(stderr, "Run ended at frame %d before golden frame %d\n", video.count_frame, golden[golden_next].frame);
+		diverged = true;
+	}
+
+	// Write final frame and run summary
+	video.UpdateTexture();
+	saveFrame("frame_last.ppm");
+
+	std::string summaryPath = std::string(out_dir) + "/summary.txt";
+	FILE* summary = fopen(summaryPath.c_str(), "w");
+	vluint64_t runCycles = main_time - start_time;
+	int runFrames = video.count_frame - start_frame;
+	vluint64_t runEvals = eval_count - start_evals;
+	double cyclesPerSecond = seconds > 0 ? runCycles / seconds : 0;
+	double framesPerSecond = seconds > 0 ? runFrames / seconds : 0;
+	double frameMs = runFrames > 0 ? (seconds * 1000.0) / runFrames : 0;
+	double emulatedSeconds = (double)main_time / clk_sys_freq;
+	double runEmulatedSeconds = (double)runCycles / clk_sys_freq;
+	for (FILE* f : { stdout, summary }) {
+		if (!f) { continue; }
+		fprintf(f, "clk_sys_freq: %d\n", clk_sys_freq);
+		fprintf(f, "rom: %s\n", rom_file);
+		fprintf(f, "cartridge: %s\n", cart_file ? cart_file : "-");
+		fprintf(f, "load: %s\n", ioctl_load ? "ioctl" : "fast");
+		fprintf(f, "cycles: %llu\n", (unsigned long long)main_time);
+		fprintf(f, "frames: %d\n", video.count_frame);
+		fprintf(f, "seconds: %.3f\n", seconds);
+		fprintf(f, "cycles_per_second: %.0f\n", cyclesPerSecond);
+		fprintf(f, "frames_per_second: %.2f\n", framesPerSecond);
+		fprintf(f, "ms_per_frame: %.3f\n", frameMs);
+		fprintf(f, "ms_per_frame_max: %.3f\n", frame_ms_max);
+		fprintf(f, "emulated_seconds: %.3f\n", emulatedSeconds);
+		fprintf(f, "evals: %llu\n", (unsigned long long)runEvals);
+		fprintf(f, "evals_per_frame: %.0f\n", runFrames > 0 ? (double)runEvals / runFrames : 0);
+		fprintf(f, "evals_per_second: %.0f\n", seconds > 0 ? runEvals / seconds : 0);
+		fprintf(f, "evals_per_emulated_second: %.0f\n", runEmulatedSeconds > 0 ? runEvals / runEmulatedSeconds : 0);
+		fprintf(f, "speed: %.3fx\n", seconds > 0 ? runEmulatedSeconds / seconds : 0);
+		if (movie_file) { fprintf(f, "movie: %s\n", movie_file); }
+		if (boot_cache) {
+			fprintf(f, "boot: %s\n", boot_result);
+			fprintf(f, "boot_load_ms: %.3f\n", boot_load_ms);
+			fprintf(f, "run_cycles: %llu\n", (unsigned long long)runCycles);
+			fprintf(f, "run_frames: %d\n", runFrames);
+		}
+		if (fast_frames > 0) {
+			fprintf(f, "fast_frames: %d\n", fast_frames);
+			fprintf(f, "fast_instructions: %llu\n", (unsigned long long)fast.instructions);
+		}
+		if (trigger_condition) {
+			if (trigger.state == TRIGGER_WRITTEN) { fprintf(f, "trigger: %llu\n", (unsigned long long)trigger.trigger_time); }
+			else { fprintf(f, "trigger: -\n"); }
+		}
+		if (report_latency) {
+			fprintf(f, "latency_inputs: %d\n", latency_count);
+			fprintf(f, "latency_cycles_min: %llu\n", (unsigned long long)latency_min);
+			fprintf(f, "latency_cycles_avg: %.0f\n", latency_count > 0 ? (double)latency_total / latency_count : 0);
+			fprintf(f, "latency_cycles_max: %llu\n", (unsigned long long)latency_max);
+		}
+		if (golden_file) { fprintf(f, "golden: %s\n", diverged ? "FAIL" : "pass"); }
+#ifdef SIM_COSIM
+		fprintf(f, "cosim_instructions: %llu\n", (unsigned long long)cosim.instructions);
+		fprintf(f, "cosim: %s\n", cosim.diverged ? "FAIL" : "pass");
+#endif
+	}
+	if (summary) { fclose(summary); }
+
+	// Clean up before exit
+	// --------------------
+	tfp->close();
+	video.CleanUp();
+	input.CleanUp();
+#ifndef DISABLE_AUDIO
+	audio.CleanUp();
+#endif
+	top->final();
+	delete top;
+
+#ifdef SIM_COSIM
+	if (cosim.diverged) { return 3; }
+#endif
+	return diverged ? 2 : 0;
+}
@@ -1,5 +1,4 @@
-#include <verilated.h>
-#include "Vtop.h"
+#include "sim_core.h"
 
 #include "imgui.h"
 #include "implot.h"
@@ -12,19 +11,17 @@
 #include <dinput.h>
 #endif
 
-#include "sim_console.h"
-#include "sim_bus.h"
-#include "sim_video.h"
-#include "sim_audio.h"
-#include "sim_input.h"
-#include "sim_clock.h"
-
 #include "../imgui/imgui_memory_editor.h"
-#include <verilated_vcd_c.h> //VCD Trace
 #include "../imgui/ImGuiFileDialog.h"
 
 #include <iostream>
 #include <fstream>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include "sim_lockfree.h"
 using namespace std;
 
 // Simulation control
@@ -32,29 +29,36 @@ using namespace std;
 int initialReset = 48;
 bool run_enable = 0;
 int batchSize = 150000;
-bool single_step = 0;
-bool multi_step = 0;
 int multi_step_amount = 1024;
 
+// Run modes: fixed batches of verilate() calls, one emulated frame per
+// batch (up to the next VSync falling edge), or frames paced to 60 fps
+enum RunMode { RUN_BATCH, RUN_FRAME, RUN_PACED };
+const char* run_mode_names[] = { "Batch", "Frame", "60 fps" };
+int run_mode = RUN_BATCH;
+const int paced_fps = 60;
+
 // Debug GUI 
 // ---------
 const char* windowTitle = "Verilator Sim: RCA Studio II";
 const char* windowTitle_Control = "Simulation control";
 const char* windowTitle_DebugLog = "Debug log";
 const char* windowTitle_Video = "VGA output";
-const char* windowTitle_Trace = "Trace/VCD control";
+const char* windowTitle_Trace = "Trace/" SIM_TRACE_NAME " control";
 const char* windowTitle_Audio = "Audio output";
 bool showDebugLog = true;
-DebugConsole console;
 MemoryEditor mem_edit;
-
-// HPS emulator
-// ------------
-SimBus bus(console);
+bool trace_export = 0;
+bool fast_load = true;
+bool fast_engine = false;
+#ifdef SIM_COSIM
+bool cosim_requests = false;
+#endif
+int video_rotate = VGA_ROTATE;
+bool video_vflip = false;
 
 // Input handling
 // --------------
-SimInput input(12, console);
 const int input_right = 0;
 const int input_left = 1;
 const int input_down = 2;
@@ -70,37 +74,25 @@ const int input_pause = 11;
 
 // Video
 // -----
-#define VGA_WIDTH 128
-#define VGA_HEIGHT 128
-#define VGA_ROTATE 0  // 90 degrees anti-clockwise
 #define VGA_SCALE_X vga_scale
 #define VGA_SCALE_Y vga_scale
-SimVideo video(VGA_WIDTH, VGA_HEIGHT, VGA_ROTATE);
 float vga_scale = 5;
 
-// Verilog module
-// --------------
-Vtop* top = NULL;
-
-vluint64_t main_time = 0;	// Current simulation time.
-double sc_time_stamp() {	// Called by $time in Verilog.
-	return main_time;
-}
-
-int clk_sys_freq = 48000000;
-SimClock clk_48(1); 
-SimClock clk_24(2); 
-
-// VCD trace logging
+// Trace logging
 // -----------------
-VerilatedVcdC* tfp = new VerilatedVcdC; //Trace
-bool Trace = 0;
 char Trace_Deep[3] = "99";
-char Trace_File[30] = "sim.vcd";
 char Trace_Deep_tmp[3] = "99";
-char Trace_File_tmp[30] = "sim.vcd";
+char Trace_File_tmp[30] = SIM_TRACE_DEFAULT_FILE;
 int  iTrace_Deep_tmp = 99;
 char SaveModel_File_tmp[20] = "test", SaveModel_File[20] = "test";
+char Movie_File[64] = "movie.txt";
+char Trigger_Condition[64] = "unsupported";
+char Trigger_File[64] = SIM_TRIGGER_DEFAULT_FILE;
+int trigger_pre = 1000;
+int trigger_post = 1000;
+int rewind_interval = 10;
+std::vector<vluint8_t> quick_state;
+bool direct_keypad = false;
 
 //Trace Save/Restore
 void save_model(const char* filenamep) {
@@ -116,111 +108,313 @@ void restore_model(const char* filenamep) {
 	os >> *top;
 }
 
-// Audio
-// -----
-#define DISABLE_AUDIO
-#ifndef DISABLE_AUDIO
-SimAudio audio(clk_sys_freq, true);
-#endif
+// Sim thread
+// ----------
+// The model is evaluated on its own thread so the GUI frame rate and the
+// simulation speed no longer limit each other. The GUI passes run settings
+// through atomics and anything that touches the model through simCommand(),
+// and reads frames (SimVideo) and debug snapshots back through mailboxes.
+std::thread sim_thread;
+std::atomic<bool> sim_quit(false);
+std::atomic<bool> sim_running(false);
+std::atomic<int> sim_batch_size(150000);
+std::atomic<int> sim_steps(0);
+std::atomic<int> sim_frame_steps(0);
+std::atomic<int> sim_run_mode(RUN_BATCH);
+float sim_frame_ms = 0;	// Wall time of the last frame run in frame mode
+std::atomic<uint32_t> sim_inputs(0);
+
+std::mutex sim_commands_mutex;
+std::vector<std::function<void()>> sim_commands;
+std::atomic<bool> sim_commands_pending(false);
+
+// Queue a function to run on the sim thread between batches
+void simCommand(std::function<void()> command) {
+	std::lock_guard<std::mutex> lock(sim_commands_mutex);
+	sim_commands.push_back(command);
+	sim_commands_pending = true;
+}
 
-// Reset simulation variables and clocks
-void resetSim() {
-	main_time = 0;
-	clk_48.Reset();
-	clk_24.Reset();
+void runSimCommands() {
+	if (!sim_commands_pending) { return; }
+	std::vector<std::function<void()>> commands;
+	{
+		std::lock_guard<std::mutex> lock(sim_commands_mutex);
+		commands.swap(sim_commands);
+		sim_commands_pending = false;
+	}
+	for (auto& command : commands) { command(); }
 }
 
-int verilate() {
+void setTrace(bool enable) {
+	trace_export = enable;
+	simCommand([enable] { Trace = enable; });
+}
 
-	if (!Verilated::gotFinish()) {
+// Debug panels
+// ------------
+// Each panel is a list of signals with their display format (NULL format
+// adds spacing). The sim thread copies every listed signal into a
+// DebugSnapshot after each batch and the GUI only ever draws the snapshot.
+struct DebugSignal {
+	const char* format;
+	const void* signal;
+	int size;
+};
+
+struct DebugPanel {
+	const char* title;
+	std::vector<DebugSignal> signals;
+};
+
+#define DEBUG_SIGNAL(format, signal) { format, &top->signal, (int)sizeof(top->signal) }
+#define DEBUG_SPACING { NULL, NULL, 0 }
+
+std::vector<DebugPanel> debugPanels;
+
+const int debug_max_signals = 128;
+struct DebugSnapshot {
+	vluint64_t main_time;
+	int count_frame;
+	float stats_fps;
+	float frame_ms;
+	signed short audio_l;
+	signed short audio_r;
+	uint32_t values[debug_max_signals];
+	CData dpram[4096];
+	CData row_cache[8];
+	CData frame_buffer[256];
+};
+SimMailbox<DebugSnapshot> debugSnapshots;
+
+void initialiseDebugPanels() {
+	debugPanels = {
+		{ "CDP 1802 Registers", {
+			DEBUG_SIGNAL("P:       0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__P),
+			DEBUG_SIGNAL("X:       0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__X),
+			DEBUG_SIGNAL("T:       0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__T),
+			DEBUG_SIGNAL("Ra:      0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__Ra),
+			DEBUG_SIGNAL("Rrd:     0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__Rrd),
+			DEBUG_SIGNAL("Rwd:     0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__Rwd),
+			DEBUG_SIGNAL("D:       0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__D),
+			DEBUG_SIGNAL("DF:      0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__DF),
+			DEBUG_SIGNAL("B:       0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__B),
+			DEBUG_SIGNAL("I:       0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__I),
+			DEBUG_SIGNAL("N:       0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__N),
+			DEBUG_SPACING,
+			DEBUG_SIGNAL("R0:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[0]),
+			DEBUG_SIGNAL("R1:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[1]),
+			DEBUG_SIGNAL("R2:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[2]),
+			DEBUG_SIGNAL("R3:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[3]),
+			DEBUG_SIGNAL("R4:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[4]),
+			DEBUG_SIGNAL("R5:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[5]),
+			DEBUG_SIGNAL("R6:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[6]),
+			DEBUG_SIGNAL("R7:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[7]),
+			DEBUG_SIGNAL("R8:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[8]),
+			DEBUG_SIGNAL("R9:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[9]),
+			DEBUG_SIGNAL("RA:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[10]),
+			DEBUG_SIGNAL("RB:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[11]),
+			DEBUG_SIGNAL("RC:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[12]),
+			DEBUG_SIGNAL("RD:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[13]),
+			DEBUG_SIGNAL("RE:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[14]),
+			DEBUG_SIGNAL("RF:      0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__R[15]),
+		} },
+		{ "CDP 1802", {
+			DEBUG_SIGNAL("RESET:        0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__RESET),
+			DEBUG_SIGNAL("CLEAR_N:      0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__CLEAR_N),
+			DEBUG_SIGNAL("WAIT_N:       0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__WAIT_N),
+			DEBUG_SIGNAL("INT_N:        0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__INT_N),
+			DEBUG_SIGNAL("Q:            0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__Q),
+			DEBUG_SIGNAL("EF:           0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__EF),
+			DEBUG_SIGNAL("SC:           0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__SC),
+			DEBUG_SIGNAL("TPA:          0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__TPA),
+			DEBUG_SIGNAL("TPB:          0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__TPB),
+			DEBUG_SPACING,
+			DEBUG_SIGNAL("dma_in_req:   0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__dma_in_req),
+			DEBUG_SIGNAL("dma_out_req:  0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__dma_out_req),
+			DEBUG_SIGNAL("io_din:       0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__io_din),
+			DEBUG_SIGNAL("io_dout:      0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__io_dout),
+			DEBUG_SIGNAL("io_n:         0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__io_n),
+			DEBUG_SIGNAL("io_inp:       0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__io_inp),
+			DEBUG_SIGNAL("io_out:       0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__io_out),
+			DEBUG_SPACING,
+			DEBUG_SIGNAL("unsupported:  0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__unsupported),
+			DEBUG_SPACING,
+			DEBUG_SIGNAL("ram_rd:       0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__ram_rd),
+			DEBUG_SIGNAL("ram_wr:       0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__ram_wr),
+			DEBUG_SIGNAL("ram_a:        0x%04X", top__DOT__rcastudio__DOT__cdp1802__DOT__ram_a),
+			DEBUG_SIGNAL("ram_q:        0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__ram_q),
+			DEBUG_SIGNAL("ram_d:        0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__ram_d),
+			DEBUG_SPACING,
+			DEBUG_SIGNAL("state:        0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__state),
+			DEBUG_SIGNAL("state_n:      0x%02X", top__DOT__rcastudio__DOT__cdp1802__DOT__state_n),
+		} },
+		{ "Pixie Video", {
+			DEBUG_SIGNAL("clk_enable:    0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__clk_enable),
+			DEBUG_SIGNAL("disp_on:       0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__disp_on),
+			DEBUG_SIGNAL("disp_off:      0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__disp_off),
+			DEBUG_SPACING,
+			DEBUG_SIGNAL("data_in:       0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__data_in),
+			DEBUG_SIGNAL("data_addr:     0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__data_addr),
+			DEBUG_SPACING,
+			DEBUG_SIGNAL("INT:           0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__INT),
+			DEBUG_SIGNAL("DMAO:          0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__DMAO),
+			DEBUG_SIGNAL("EFx:           0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__EFx),
+			DEBUG_SPACING,
+			DEBUG_SIGNAL("csync:         0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__csync),
+			DEBUG_SIGNAL("video:         0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__video),
+			DEBUG_SPACING,
+			DEBUG_SIGNAL("VSync:         0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__VSync),
+			DEBUG_SIGNAL("HSync:         0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__HSync),
+			DEBUG_SIGNAL("VBlank:        0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__VBlank),
+			DEBUG_SIGNAL("HBlank:        0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__HBlank),
+			DEBUG_SIGNAL("video_de:      0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__video_de),
+		} },
+		{ "Pixie Video Studio II", {
+			DEBUG_SIGNAL("enabled:       0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__display_enabled),
+			DEBUG_SIGNAL("disp_on:       0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__disp_on),
+			DEBUG_SIGNAL("disp_off:      0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__disp_off),
+			DEBUG_SIGNAL("SC:            0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__SC),
+			DEBUG_SIGNAL("data_in:       0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__data_in),
+			DEBUG_SIGNAL("DMAO:          0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__DMAO),
+			DEBUG_SIGNAL("DMA_xfer:      0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__DMA_xfer),
+			DEBUG_SIGNAL("INT:           0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__INT),
+			DEBUG_SIGNAL("EFx:           0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__EFx),
+			DEBUG_SPACING,
+			DEBUG_SIGNAL("mem_addr:      0x%04X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__mem_addr),
+			DEBUG_SPACING,
+			DEBUG_SIGNAL("hori_pixel_counter: 0x%04X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__horizontal_pixel_counter),
+			DEBUG_SIGNAL("ver_pixel_counter:  0x%04X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__vertical_pixel_counter),
+			DEBUG_SIGNAL("pixel_shift_reg:    0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__pixel_shift_reg),
+			DEBUG_SPACING,
+			DEBUG_SIGNAL("HSync:          0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__HSync),
+			DEBUG_SIGNAL("VSync:          0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__VSync),
+			DEBUG_SIGNAL("VBlank:         0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__VBlank),
+			DEBUG_SIGNAL("HBlank:         0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__HBlank),
+			DEBUG_SIGNAL("video_de:       0x%02X", top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__video_de),
+		} },
+		{ "ioctl", {
+			DEBUG_SIGNAL("ioctl_download: 0x%02X", top__DOT__rcastudio__DOT__ioctl_download),
+			DEBUG_SIGNAL("ioctl_wr:       0x%02X", top__DOT__rcastudio__DOT__ioctl_wr),
+			DEBUG_SIGNAL("ioctl_addr:     0x%04X", top__DOT__rcastudio__DOT__ioctl_addr),
+			DEBUG_SIGNAL("ioctl_dout:     0x%02X", top__DOT__rcastudio__DOT__ioctl_dout),
+			DEBUG_SPACING,
+		} },
+		{ "Sim", {
+			DEBUG_SIGNAL("reset:	  0x%02X", top__DOT__rcastudio__DOT__reset),
+			DEBUG_SIGNAL("ps2_key:	0x%02X", top__DOT__ps2_key),
+			DEBUG_SIGNAL("code:	   0x%02X", top__DOT__rcastudio__DOT__code),
+			DEBUG_SIGNAL("pressed:	0x%02X", top__DOT__rcastudio__DOT__pressed),
+			DEBUG_SPACING,
+		} },
+		{ "Controls", {
+			DEBUG_SIGNAL("Player A: 	0x%03X", top__DOT__rcastudio__DOT__playerA),
+			DEBUG_SIGNAL("Player B: 	0x%03X", top__DOT__rcastudio__DOT__playerB),
+			DEBUG_SIGNAL("KeyLatch: 	0x%03X", top__DOT__rcastudio__DOT__keylatch),
+			DEBUG_SPACING,
+		} },
+	};
+}
 
-		// Assert reset during startup
-		//if (main_time < initialReset) { top->reset = 1; }
-		// Deassert reset after startup
-		//if (main_time == initialReset) { top->reset = 0; }
+// Copy the current model state for the GUI, runs on the sim thread
+void captureDebugSnapshot() {
+	DebugSnapshot& snapshot = debugSnapshots.Back();
+	snapshot.main_time = main_time;
+	snapshot.count_frame = video.count_frame;
+	snapshot.stats_fps = video.stats_fps;
+	snapshot.frame_ms = sim_frame_ms;
+	snapshot.audio_l = (signed short)top->AUDIO_L;
+	snapshot.audio_r = (signed short)top->AUDIO_R;
+
+	int index = 0;
+	for (const DebugPanel& panel : debugPanels) {
+		for (const DebugSignal& signal : panel.signals) {
+			if (!signal.format || index == debug_max_signals) { continue; }
+			uint32_t value = 0;
+			switch (signal.size) {
+			case 1: value = *(const CData*)signal.signal; break;
+			case 2: value = *(const SData*)signal.signal; break;
+			case 4: value = *(const IData*)signal.signal; break;
+			case 8: value = (uint32_t)*(const QData*)signal.signal; break;
+			}
+			snapshot.values[index++] = value;
+		}
+	}
 
-		// Clock dividers
-		clk_48.Tick();
-		clk_24.Tick();
+	memcpy(snapshot.dpram, &top->top__DOT__rcastudio__DOT__dpram__DOT__mem, sizeof(snapshot.dpram));
+	memcpy(snapshot.row_cache, &top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__row_cache, sizeof(snapshot.row_cache));
+	memcpy(snapshot.frame_buffer, &top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__frame_buffer, sizeof(snapshot.frame_buffer));
+	debugSnapshots.Publish();
+}
 
-		// Set clocks in core
-		top->clk_48 = clk_48.clk;
-		top->clk_24 = clk_24.clk;
+void drawDebugPanels(const DebugSnapshot& snapshot) {
+	int index = 0;
+	for (const DebugPanel& panel : debugPanels) {
+		ImGui::Begin(panel.title);
+		for (const DebugSignal& signal : panel.signals) {
+			if (!signal.format) { ImGui::Spacing(); continue; }
+			if (index == debug_max_signals) { continue; }
+			ImGui::Text(signal.format, snapshot.values[index++]);
+		}
+		ImGui::End();
+	}
+}
 
-		// Simulate both edges of fastest clock
-		if (clk_48.clk != clk_48.old) {
+void simThreadMain() {
+	const std::chrono::nanoseconds frame_period(1000000000 / paced_fps);
+	std::chrono::steady_clock::time_point next_frame = std::chrono::steady_clock::now();
 
-			// System clock simulates HPS functions
-			if (clk_48.clk) {
-				input.BeforeEval();
-				bus.BeforeEval();
-			}
-			top->eval();
-			if (Trace) {
-				if (!tfp->isOpen()) tfp->open(Trace_File);
-				tfp->dump(main_time); //Trace
-			}
+	while (!sim_quit) {
+		runSimCommands();
 
-			// System clock simulates HPS functions
-			if (clk_48.clk) { bus.AfterEval(); }
-		}
+		// Pass inputs to sim, applied in SimInput::BeforeEval
+		input.live_inputs = sim_inputs;
 
-#ifndef DISABLE_AUDIO
-		if (clk_48.IsRising())
-		{
-			audio.Clock(top->AUDIO_L, top->AUDIO_R);
+		// Run simulation
+		int mode = sim_run_mode;
+		int steps = 0;
+		int frames = 0;
+		if (sim_running) {
+			if (mode == RUN_BATCH) { steps = sim_batch_size; }
+			else { frames = 1; }
+		}
+		else {
+			steps = sim_steps.exchange(0);
+			frames = sim_frame_steps.exchange(0);
 		}
+		for (int step = 0; step < steps; step++) {
+			verilate();
+#ifdef SIM_COSIM
+			if (cosim.diverged) { break; }
 #endif
-
-		// Output pixels on rising edge of pixel clock
-		if (clk_48.IsRising() && top->top__DOT__ce_pix) {
-			uint32_t colour = 0xFF000000 | top->VGA_B << 16 | top->VGA_G << 8 | top->VGA_R;
-			video.Clock(top->VGA_HB, top->VGA_VB, top->VGA_HS, top->VGA_VS, colour);
 		}
-
-		if (clk_48.IsRising()) {
-			main_time++;
+		for (int frame = 0; frame < frames; frame++) {
+			std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+			verilateFrame();
+			sim_frame_ms = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+		}
+		captureDebugSnapshot();
+
+		// Hold back to the wall clock, resync if we fell more than a frame behind
+		if (sim_running && mode == RUN_PACED) {
+			next_frame += frame_period;
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (now > next_frame + frame_period) { next_frame = now; }
+			else { std::this_thread::sleep_until(next_frame); }
+		}
+		else {
+			next_frame = std::chrono::steady_clock::now();
 		}
-		return 1;
-	}
 
-	// Stop verilating and cleanup
-	top->final();
-	delete top;
-	exit(0);
-	return 0;
+		// Nothing to do, don't spin
+		if (steps == 0 && frames == 0) { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+	}
 }
 
 int main(int argc, char** argv, char** env) {
 
-	// Create core and initialise
-	top = new Vtop();
-	Verilated::commandArgs(argc, argv);
-
-	//Prepare for Dump Signals
-	Verilated::traceEverOn(true); //Trace
-	top->trace(tfp, 1);// atoi(Trace_Deep) );  // Trace 99 levels of hierarchy
-	if (Trace) tfp->open(Trace_File);//"simx.vcd"); //Trace
-
-#ifdef WIN32
-	// Attach debug console to the verilated code
-	Verilated::setDebug(console);
-#endif
-
-	// Attach bus
-	bus.ioctl_addr = &top->ioctl_addr;
-	bus.ioctl_index = &top->ioctl_index;
-	bus.ioctl_wait = &top->ioctl_wait;
-	bus.ioctl_download = &top->ioctl_download;
-	bus.ioctl_upload = &top->ioctl_upload;
-	bus.ioctl_wr = &top->ioctl_wr;
-	bus.ioctl_dout = &top->ioctl_dout;
-	bus.ioctl_din = &top->ioctl_din;
-    input.ps2_key = &top->ps2_key;
-
-#ifndef DISABLE_AUDIO
-	audio.Initialise();
-#endif
+	// Create core, attach trace and bus
+	initialiseSim(argc, argv);
 
 	// Set up input module
 	input.Initialise();
@@ -251,9 +445,14 @@ int main(int argc, char** argv, char** env) {
 #endif
 	// Setup video output
 	if (video.Initialise(windowTitle) == 1) { return 1; }
+	initialiseDebugPanels();
+	mem_edit.ReadOnly = true;
 
 	bus.QueueDownload("./boot.rom", 0, true);
+	rewind_buffer.interval = rewind_interval;
 
+	// Start sim thread
+	sim_thread = std::thread(simThreadMain);
 
 #ifdef WIN32
 	MSG msg;
@@ -282,6 +481,9 @@ int main(int argc, char** argv, char** env) {
 
 		input.Read();
 
+		// Latest state published by the sim thread
+		debugSnapshots.Update();
+		const DebugSnapshot& snapshot = debugSnapshots.Front();
 
 		// Draw GUI
 		// --------
@@ -291,17 +493,18 @@ int main(int argc, char** argv, char** env) {
 		ImGui::Begin(windowTitle_Control);
 		ImGui::SetWindowPos(windowTitle_Control, ImVec2(0, 0), ImGuiCond_Once);
 		ImGui::SetWindowSize(windowTitle_Control, ImVec2(500, 150), ImGuiCond_Once);
-		if (ImGui::Button("Reset simulation")) { resetSim(); } ImGui::SameLine();
+		if (ImGui::Button("Reset simulation")) { simCommand(resetSim); } ImGui::SameLine();
 		if (ImGui::Button("Start running")) { run_enable = 1; } ImGui::SameLine();
 		if (ImGui::Button("Stop running")) { run_enable = 0; } ImGui::SameLine();
 		ImGui::Checkbox("RUN", &run_enable);
 		//ImGui::PopItemWidth();
+		ImGui::Combo("Run mode", &run_mode, run_mode_names, IM_ARRAYSIZE(run_mode_names));
 		ImGui::SliderInt("Run batch size", &batchSize, 1, 250000);
-		if (single_step == 1) { single_step = 0; }
-		if (ImGui::Button("Single Step")) { run_enable = 0; single_step = 1; }
+		if (ImGui::Button("Single Step")) { run_enable = 0; sim_steps = 1; }
+		ImGui::SameLine();
+		if (ImGui::Button("Multi Step")) { run_enable = 0; sim_steps = multi_step_amount; }
 		ImGui::SameLine();
-		if (multi_step == 1) { multi_step = 0; }
-		if (ImGui::Button("Multi Step")) { run_enable = 0; multi_step = 1; }
+		if (ImGui::Button("Frame Step")) { run_enable = 0; sim_frame_steps = 1; }
 		//ImGui::SameLine();
 		ImGui::SliderInt("Multi step amount", &multi_step_amount, 8, 1024);
 		if (ImGui::Button("Load ST2"))
@@ -309,7 +512,39 @@ int main(int argc, char** argv, char** env) {
 		ImGui::SameLine();
 		if (ImGui::Button("Load BIN"))
     	ImGuiFileDialog::Instance()->OpenDialog("ChooseFileDlgKey", "Choose File", ".bin", ".");
+		ImGui::SameLine();
+		if (ImGui::Checkbox("Fast load", &fast_load)) {
+			bool enable = fast_load;
+			simCommand([enable] { bus.fast_load = enable; });
+		}
+		ImGui::SameLine();
+		ImGui::Checkbox("Direct keypad", &direct_keypad);
+		if (ImGui::Checkbox("Fast engine", &fast_engine)) {
+			bool enable = fast_engine;
+			simCommand([enable] { requestFast(enable); });
+		}
+		ImGui::SameLine();
+		ImGui::Text(fast.active == fast_engine ? (fast.active ? "running functional model" : "running RTL") : "waiting for vertical blank");
+		input.direct_keypad = direct_keypad;
+#ifdef SIM_COSIM
+		// Stop at the first divergence, the report is in the debug log
+		if (cosim.diverged) {
+			run_enable = 0;
+			ImGui::Text("Co-sim: diverged, see the debug log");
+			ImGui::SameLine();
+			if (ImGui::Button("Resync")) { simCommand([] { cosim.Resync(); cosim.diverged = false; }); }
+		}
+		else { ImGui::Text("Co-sim: in lockstep"); }
+		ImGui::SameLine();
+		if (ImGui::Checkbox("Stop at unserved DMA/INT", &cosim_requests)) {
+			bool enable = cosim_requests;
+			simCommand([enable] { cosim.check_requests = enable; });
+		}
+#endif
 		ImGui::End();
+		sim_running = run_enable;
+		sim_batch_size = batchSize;
+		sim_run_mode = run_mode;
 
 		// Debug log window
 		console.Draw(windowTitle_DebugLog, &showDebugLog, ImVec2(500, 700));
@@ -320,182 +555,119 @@ int main(int argc, char** argv, char** env) {
 		//mem_edit.DrawContents(&top->top__DOT__rcastudio__DOT__Rom_StudioII__DOT__d, 2048, 0);
 		//ImGui::End();
 		ImGui::Begin("DPRAM");
-		mem_edit.DrawContents(&top->top__DOT__rcastudio__DOT__dpram__DOT__mem, 4096, 0);
+		mem_edit.DrawContents((void*)snapshot.dpram, 4096, 0);
 		ImGui::End();		
 		ImGui::Begin("Pixie Studio II Row Cache");
-		mem_edit.DrawContents(&top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__row_cache, 8, 0);		
+		mem_edit.DrawContents((void*)snapshot.row_cache, 8, 0);		
 		ImGui::End();
 		ImGui::Begin("Pixie Studio II Frame Buffer");
-		mem_edit.DrawContents(&top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__frame_buffer, 256, 0);		
-		ImGui::End();
-
-		// Debug 1802 cpu
-		ImGui::Begin("CDP 1802 Registers");
-		ImGui::Text("P:       0x%04X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__P);	
-		ImGui::Text("X:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__X);
-		ImGui::Text("T:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__T);
-		ImGui::Text("R:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__R);	
-		ImGui::Text("Ra:      0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__Ra);			
-		ImGui::Text("Rrd:     0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__Rrd);	
-		ImGui::Text("Rwd:     0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__Rwd);	
-		ImGui::Text("D:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__D);
-		ImGui::Text("DF:      0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__DF);	
-		ImGui::Text("B:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__B);	
-		ImGui::Text("I:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__I);	
-		ImGui::Text("N:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__N);	
-		ImGui::Spacing();		
-		ImGui::End();
-
-		ImGui::Begin("CDP 1802");
-		ImGui::Text("RESET:        0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__RESET);	
-		ImGui::Text("CLEAR_N:      0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__CLEAR_N);	
-		ImGui::Text("WAIT_N:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__WAIT_N);	
-		ImGui::Text("INT_N:        0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__INT_N);									
-		ImGui::Text("Q:            0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__Q);	
-		ImGui::Text("EF:           0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__EF);
-		ImGui::Text("SC:           0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__SC);	
-		ImGui::Text("TPA:          0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__TPA);	
-		ImGui::Text("TPB:          0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__TPB);	
-		ImGui::Spacing();	
-		ImGui::Text("dma_in_req:   0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__dma_in_req);	
-		ImGui::Text("dma_out_req:  0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__dma_out_req);					
-		ImGui::Text("io_din:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__io_din);	
-		ImGui::Text("io_dout:      0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__io_dout);
-		ImGui::Text("io_n:         0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__io_n);	
-		ImGui::Text("io_inp:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__io_inp);	
-		ImGui::Text("io_out:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__io_out);					
-		ImGui::Spacing();	
-		ImGui::Text("unsupported:  0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__unsupported);	
-		ImGui::Spacing();		
-		ImGui::Text("ram_rd:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_rd);
-		ImGui::Text("ram_wr:       0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_wr);	
-		ImGui::Text("ram_a:        0x%04X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_a);	
-		ImGui::Text("ram_q:        0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_q);			
-		ImGui::Text("ram_d:        0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__ram_d);			
-		ImGui::Spacing();	
-		ImGui::Text("state:        0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__state);				
-		ImGui::Text("state_n:      0x%02X", top->top__DOT__rcastudio__DOT__cdp1802__DOT__state_n);			
-		ImGui::End();
-
-		// Debug Pixie Video
-		ImGui::Begin("Pixie Video");
-		ImGui::Text("clk_enable:    0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__clk_enable);		
-		ImGui::Text("disp_on:       0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__disp_on);	
-		ImGui::Text("disp_off:      0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__disp_off);
-		ImGui::Spacing();			
-		ImGui::Text("data_in:       0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__data_in);
-		ImGui::Text("data_addr:     0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__data_addr);
-		ImGui::Spacing();	
-		ImGui::Text("INT:           0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__INT);
-		ImGui::Text("DMAO:          0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__DMAO);
-		ImGui::Text("EFx:           0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__EFx);
-		ImGui::Spacing();
-		ImGui::Text("csync:         0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__csync);
-		ImGui::Text("video:         0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__video);
-		ImGui::Spacing();
-		ImGui::Text("VSync:         0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__VSync);
-		ImGui::Text("HSync:         0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__HSync);
-		ImGui::Text("VBlank:        0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__VBlank);
-		ImGui::Text("HBlank:        0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__HBlank);
-		ImGui::Text("video_de:      0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__video_de);								
-		ImGui::End();
-
-		ImGui::Begin("Pixie Video Studio II");
-		ImGui::Text("enabled:       0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__display_enabled);			
-		ImGui::Text("disp_on:       0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__disp_on);	
-		ImGui::Text("disp_off:      0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__disp_off);
-		ImGui::Text("SC:            0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__SC);		
-		ImGui::Text("data_in:       0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__data_in);
-		ImGui::Text("DMAO:          0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__DMAO);	
-		ImGui::Text("DMA_xfer:      0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__DMA_xfer);			
-		ImGui::Text("INT:           0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__INT);	
-		ImGui::Text("EFx:           0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__EFx);							
-		ImGui::Spacing();	
-		ImGui::Text("mem_addr:      0x%04X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__mem_addr);
-		ImGui::Spacing();	
-		ImGui::Text("hori_pixel_counter: 0x%04X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__horizontal_pixel_counter);
-		ImGui::Text("ver_pixel_counter:  0x%04X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__vertical_pixel_counter);
-		ImGui::Text("pixel_shift_reg:    0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__pixel_shift_reg);		
-		ImGui::Spacing();	
-		ImGui::Text("HSync:          0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__HSync);
-		ImGui::Text("VSync:          0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__VSync);
-		ImGui::Text("VBlank:         0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__VBlank);
-		ImGui::Text("HBlank:         0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__HBlank);		
-		ImGui::Text("video_de:       0x%02X", top->top__DOT__rcastudio__DOT__pixie_video__DOT__pixie_video_studioii__DOT__video_de);								
-		ImGui::End();
-
-		// Debug ioctl
-		ImGui::Begin("ioctl");
-		ImGui::Text("ioctl_download: 0x%02X", top->top__DOT__rcastudio__DOT__ioctl_download);	
-		ImGui::Text("ioctl_wr:       0x%02X", top->top__DOT__rcastudio__DOT__ioctl_wr);
-		ImGui::Text("ioctl_addr:     0x%04X", top->top__DOT__rcastudio__DOT__ioctl_addr);
-		ImGui::Text("ioctl_dout:     0x%02X", top->top__DOT__rcastudio__DOT__ioctl_dout);		
-		ImGui::Spacing();														
-		ImGui::End();
-
-		// Debug sim
-		ImGui::Begin("Sim");
-		ImGui::Text("reset:	  0x%02X", top->top__DOT__rcastudio__DOT__reset);	
-		ImGui::Text("ps2_key:	0x%02X", top->top__DOT__ps2_key);		
-		ImGui::Text("code:	   0x%02X", top->top__DOT__rcastudio__DOT__code);	
-		ImGui::Text("pressed:	0x%02X", top->top__DOT__rcastudio__DOT__pressed);			
-		ImGui::Spacing();														
+		mem_edit.DrawContents((void*)snapshot.frame_buffer, 256, 0);		
 		ImGui::End();
 
-		// Debug Keypad 1
-//		ImGui::Begin("Keypad 1");
-//		ImGui::Text("btnKP1: 	0x%02X", top->top__DOT__rcastudio__DOT__btnKP1);	
-		/*ImGui::Text("btnKP1_2: 	0x%02X", top->top__DOT__rcastudio__DOT__btnKP1_2);
-		ImGui::Text("btnKP1_3: 	0x%02X", top->top__DOT__rcastudio__DOT__btnKP1_3);
-		ImGui::Text("btnKP1_4: 	0x%02X", top->top__DOT__rcastudio__DOT__btnKP1_4);
-		ImGui::Text("btnKP1_5: 	0x%02X", top->top__DOT__rcastudio__DOT__btnKP1_5);		
-		ImGui::Text("btnKP1_6: 	0x%02X", top->top__DOT__rcastudio__DOT__btnKP1_6);	
-		ImGui::Text("btnKP1_7: 	0x%02X", top->top__DOT__rcastudio__DOT__btnKP1_7);
-		ImGui::Text("btnKP1_8: 	0x%02X", top->top__DOT__rcastudio__DOT__btnKP1_8);
-		ImGui::Text("btnKP1_9: 	0x%02X", top->top__DOT__rcastudio__DOT__btnKP1_9);
-		ImGui::Text("btnKP1_0: 	0x%02X", top->top__DOT__rcastudio__DOT__btnKP1_0);	*/						
-//		ImGui::Spacing();														
-//		ImGui::End();
-
-		//PlayerA
-		ImGui::Begin("Controls");
-		ImGui::Text("Player A: 	0x%03X", top->top__DOT__rcastudio__DOT__playerA);
-		ImGui::Text("Player B: 	0x%03X", top->top__DOT__rcastudio__DOT__playerB);
-		ImGui::Text("KeyLatch: 	0x%03X", top->top__DOT__rcastudio__DOT__keylatch);
-		ImGui::Spacing();														
-		ImGui::End();
+		// Debug cpu, video, ioctl, sim and controls
+		drawDebugPanels(snapshot);
 		
-		// Trace/VCD window
+		// Trace window
 		ImGui::Begin(windowTitle_Trace);
 		ImGui::SetWindowPos(windowTitle_Trace, ImVec2(0, 870), ImGuiCond_Once);
-		ImGui::SetWindowSize(windowTitle_Trace, ImVec2(500, 150), ImGuiCond_Once);
+		ImGui::SetWindowSize(windowTitle_Trace, ImVec2(500, 330), ImGuiCond_Once);
 
-		if (ImGui::Button("Start VCD Export")) { Trace = 1; } ImGui::SameLine();
-		if (ImGui::Button("Stop VCD Export")) { Trace = 0; } ImGui::SameLine();
-		if (ImGui::Button("Flush VCD Export")) { tfp->flush(); } ImGui::SameLine();
-		ImGui::Checkbox("Export VCD", &Trace);
+		if (ImGui::Button("Start " SIM_TRACE_NAME " Export")) { setTrace(1); } ImGui::SameLine();
+		if (ImGui::Button("Stop " SIM_TRACE_NAME " Export")) { setTrace(0); } ImGui::SameLine();
+		if (ImGui::Button("Flush " SIM_TRACE_NAME " Export")) { simCommand([] { tfp->flush(); }); } ImGui::SameLine();
+		if (ImGui::Checkbox("Export " SIM_TRACE_NAME, &trace_export)) { setTrace(trace_export); }
 
 		ImGui::PushItemWidth(120);
 		if (ImGui::InputInt("Deep Level", &iTrace_Deep_tmp, 1, 100, ImGuiInputTextFlags_EnterReturnsTrue))
 		{
-			top->trace(tfp, iTrace_Deep_tmp);
+			int depth = iTrace_Deep_tmp;
+			simCommand([depth] { top->trace(tfp, depth); });
 		}
 
 		if (ImGui::InputText("TraceFilename", Trace_File_tmp, IM_ARRAYSIZE(Trace_File), ImGuiInputTextFlags_EnterReturnsTrue))
 		{
-			strcpy(Trace_File, Trace_File_tmp); //TODO onChange Close and open new trace file
-			tfp->close();
-			if (Trace) tfp->open(Trace_File);
+			std::string file = Trace_File_tmp;
+			simCommand([file] {
+				strcpy(Trace_File, file.c_str()); //TODO onChange Close and open new trace file
+				tfp->close();
+				if (Trace) tfp->open(Trace_File);
+			});
 		};
 		ImGui::Separator();
-		if (ImGui::Button("Save Model")) { save_model(SaveModel_File); } ImGui::SameLine();
+		if (ImGui::Button("Save Model")) {
+			std::string file = SaveModel_File;
+			simCommand([file] { save_model(file.c_str()); });
+		} ImGui::SameLine();
 		if (ImGui::Button("Load Model")) {
-			restore_model(SaveModel_File);
+			std::string file = SaveModel_File;
+			simCommand([file] { restore_model(file.c_str()); });
 		} ImGui::SameLine();
 		if (ImGui::InputText("SaveFilename", SaveModel_File_tmp, IM_ARRAYSIZE(SaveModel_File), ImGuiInputTextFlags_EnterReturnsTrue))
 		{
 			strcpy(SaveModel_File, SaveModel_File_tmp); //TODO onChange Close and open new trace file
 		}
+		if (ImGui::Button("Quick Save")) {
+			simCommand([] {
+				if (fast.active) {
+					console.AddLog("Quick save holds the RTL, turn the fast engine off first");
+					return;
+				}
+				SimStateWriter os;
+				saveState(os);
+				quick_state = os.data;
+				console.AddLog("Quick save at frame %d", video.count_frame);
+			});
+		} ImGui::SameLine();
+		if (ImGui::Button("Quick Load")) {
+			simCommand([] {
+				if (quick_state.size() > 0 && !loadState(quick_state)) { console.AddLog("Quick load failed"); }
+			});
+		} ImGui::SameLine();
+		if (ImGui::Button("Rewind")) {
+			simCommand([] {
+				std::vector<vluint8_t> state;
+				if (rewind_buffer.Pop(state) && !loadState(state)) { console.AddLog("Rewind failed"); }
+			});
+		} ImGui::SameLine();
+		ImGui::Text("%d snapshots, frames %d-%d, %d KB", (int)rewind_buffer.count, (int)rewind_buffer.oldest_frame,
+			(int)rewind_buffer.newest_frame, (int)(rewind_buffer.compressed_bytes / 1024));
+		if (ImGui::InputInt("Rewind every N frames (0 = off)", &rewind_interval, 1, 10)) {
+			int interval = rewind_interval < 0 ? 0 : rewind_interval;
+			simCommand([interval] {
+				rewind_buffer.interval = interval;
+				rewind_buffer.Clear();
+			});
+		}
+		ImGui::Separator();
+		if (ImGui::Button("Record Movie")) {
+			std::string file = Movie_File;
+			simCommand([file] { input.RecordMovie(file.c_str(), main_time); });
+		} ImGui::SameLine();
+		if (ImGui::Button("Replay Movie")) {
+			std::string file = Movie_File;
+			simCommand([file] { input.ReplayMovie(file.c_str()); });
+		} ImGui::SameLine();
+		if (ImGui::Button("Stop Movie")) { simCommand([] { input.StopMovie(); }); } ImGui::SameLine();
+		ImGui::Text("%s", input.movie_mode == MOVIE_RECORD ? "REC" : input.movie_mode == MOVIE_REPLAY ? "PLAY" : "");
+		ImGui::InputText("MovieFilename", Movie_File, IM_ARRAYSIZE(Movie_File));
+		ImGui::Separator();
+		if (ImGui::Button("Arm Trigger")) {
+			std::string condition = Trigger_Condition;
+			std::string file = Trigger_File;
+			int pre = trigger_pre, post = trigger_post;
+			simCommand([condition, file, pre, post] {
+				trigger.pre_cycles = pre;
+				trigger.post_cycles = post;
+				trigger.Arm(condition.c_str(), file.c_str());
+			});
+		} ImGui::SameLine();
+		if (ImGui::Button("Disarm Trigger")) { simCommand([] { trigger.Disarm(); }); } ImGui::SameLine();
+		const char* triggerStates[] = { "", "ARMED", "CAPTURING", "WRITTEN" };
+		ImGui::Text("%s", triggerStates[trigger.state]);
+		ImGui::InputText("Condition", Trigger_Condition, IM_ARRAYSIZE(Trigger_Condition));
+		ImGui::InputInt("Cycles before", &trigger_pre, 100, 10000); ImGui::SameLine();
+		ImGui::InputInt("Cycles after", &trigger_post, 100, 10000);
+		ImGui::InputText("TriggerFilename", Trigger_File, IM_ARRAYSIZE(Trigger_File));
 		ImGui::End();
 		int windowX = 550;
 		int windowWidth = (VGA_WIDTH * VGA_SCALE_X) + 24;
@@ -509,9 +681,15 @@ int main(int argc, char** argv, char** env) {
 		ImGui::SetNextItemWidth(400);
 		ImGui::SliderFloat("Zoom", &vga_scale, 1, 8); ImGui::SameLine();
 		ImGui::SetNextItemWidth(200);
-		ImGui::SliderInt("Rotate", &video.output_rotate, -1, 1); ImGui::SameLine();
-		ImGui::Checkbox("Flip V", &video.output_vflip);
-		ImGui::Text("main_time: %d frame_count: %d sim FPS: %f", main_time, video.count_frame, video.stats_fps);
+		if (ImGui::SliderInt("Rotate", &video_rotate, -1, 1)) {
+			int rotate = video_rotate;
+			simCommand([rotate] { video.output_rotate = rotate; });
+		} ImGui::SameLine();
+		if (ImGui::Checkbox("Flip V", &video_vflip)) {
+			bool vflip = video_vflip;
+			simCommand([vflip] { video.output_vflip = vflip; });
+		}
+		ImGui::Text("main_time: %llu frame_count: %d sim FPS: %f frame: %.2f ms", (unsigned long long)snapshot.main_time, snapshot.count_frame, snapshot.stats_fps, snapshot.frame_ms);
 		//ImGui::Text("pixel: %06d line: %03d", video.count_pixel, video.count_line);
 
 		// Draw VGA output
@@ -528,7 +706,7 @@ int main(int argc, char** argv, char** env) {
       			// action
 				fprintf(stderr,"filePathName: %s\n",filePathName.c_str());
 				fprintf(stderr,"filePath: %s\n",filePath.c_str());
-     			bus.QueueDownload(filePathName, 1, 1);
+     			simCommand([filePathName] { queueCartridge(filePathName); });
     		}
     		// close
     		ImGuiFileDialog::Instance()->Close();
@@ -548,7 +726,7 @@ int main(int argc, char** argv, char** env) {
 
 		int ticksPerSec = (24000000 / 60);
 		if (run_enable) {
-			audio.CollectDebug((signed short)top->AUDIO_L, (signed short)top->AUDIO_R);
+			audio.CollectDebug(snapshot.audio_l, snapshot.audio_r);
 		}
 		int channelWidth = (windowWidth / 2) - 16;
 		ImPlot::CreateContext();
@@ -566,6 +744,12 @@ int main(int argc, char** argv, char** env) {
 			ImPlot::EndPlot();
 		}
 		ImPlot::DestroyContext();
+		if (audio.live_output) {
+			ImGui::Text("Live: buffer %3.0f%%  rate %.3f  underruns %d", audio.stats_fill.load() * 100.0f, audio.stats_ratio.load(), audio.stats_underruns.load());
+		}
+		else {
+			ImGui::Text("Live: no audio device");
+		}
 		ImGui::End();
 #endif
 
@@ -573,24 +757,18 @@ int main(int argc, char** argv, char** env) {
 
 
 		// Pass inputs to sim
-		top->inputs = 0;
+		uint32_t inputs = 0;
 		for (int i = 0; i < input.inputCount; i++)
 		{
-			if (input.inputs[i]) { top->inputs |= (1 << i); }
-		}
-
-		// Run simulation
-		if (run_enable) {
-			for (int step = 0; step < batchSize; step++) { verilate(); }
-		}
-		else {
-			if (single_step) { verilate(); }
-			if (multi_step) {
-				for (int step = 0; step < multi_step_amount; step++) { verilate(); }
-			}
+			if (input.inputs[i]) { inputs |= (1 << i); }
 		}
+		sim_inputs = inputs;
 	}
 
+	// Stop sim thread
+	sim_quit = true;
+	sim_thread.join();
+
 	// Clean up before exit
 	// --------------------
 
@@ -599,6 +777,8 @@ int main(int argc, char** argv, char** env) {
 #endif 
 	video.CleanUp();
 	input.CleanUp();
+	trigger.Finish();
+	tfp->close();	// FST is only readable once closed
 
 	return 0;
 }
@@ -0,0 +1,52 @@
+#!/bin/sh
+# Profile-guided optimization helper, used by "make pgo".
+#
+#   sim_pgo.sh train <exe> <frames> "<cartridges>" "<movie>" "<movie cartridge>"
+#     Runs the training workload on an instrumented headless runner: a boot
+#     of ./boot.rom, each cartridge, then the input movie (if any) replayed
+#     to its last event, <frames> frames each for the boot and cartridges.
+#
+#   sim_pgo.sh compare <frames> <repeat> <before exe> <after exe>
+#     Boots both runners <frames> frames, <repeat> times, and prints the
+#     best cycles_per_second of each and the gain.
+
+cps() {
+	best=0
+	i=0
+	while [ $i -lt "$3" ]; do
+		run=$("$1" -f "$2" -o "$(dirname "$1")/bench_out" | sed -n 's/^cycles_per_second: //p')
+		if [ -n "$run" ] && [ "$run" -gt "$best" ]; then best=$run; fi
+		i=$((i + 1))
+	done
+	echo "$best"
+}
+
+case "$1" in
+train)
+	exe=$2
+	frames=$3
+	out=$(dirname "$exe")/train_out
+	echo "Training: boot, $frames frames"
+	"$exe" -f "$frames" -o "$out" > /dev/null || exit 1
+	for cart in $4; do
+		echo "Training: $cart, $frames frames"
+		"$exe" -f "$frames" -o "$out" "$cart" > /dev/null || exit 1
+	done
+	if [ -n "$5" ]; then
+		echo "Training: movie $5"
+		"$exe" -m "$5" -o "$out" $6 > /dev/null || exit 1
+	fi
+	;;
+compare)
+	before=$(cps "$4" "$2" "$3")
+	after=$(cps "$5" "$2" "$3")
+	echo "cycles/s before PGO: $before"
+	echo "cycles/s after PGO:  $after"
+	awk "BEGIN { if ($before > 0) printf \"gain: %.2fx\\n\", $after / $before }"
+	;;
+*)
+	echo "Usage: $0 train <exe> <frames> \"<cartridges>\" \"<movie>\" \"<movie cartridge>\""
+	echo "       $0 compare <frames> <repeat> <before exe> <after exe>"
+	exit 1
+	;;
+esac
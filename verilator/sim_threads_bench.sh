@@ -0,0 +1,50 @@
+#!/bin/sh
+# Times headless runner builds on the same run and links the fastest.
+#
+#   sim_threads_bench.sh <frames> <repeat> <name>=<exe> ...
+#
+# Each exe boots ./boot.rom for <frames> frames, <repeat> times; the best
+# cycles_per_second of its runs is reported. The fastest build is linked as
+# ./Vtop_headless_threads and its name written to threads_best.txt. Used by
+# "make threads-bench".
+
+frames=$1
+repeat=$2
+shift 2
+
+best_name=
+best_exe=
+best_cps=0
+
+printf "%-10s %16s %10s\n" variant cycles/s speedup
+for variant in "$@"; do
+	name=${variant%%=*}
+	exe=${variant#*=}
+	if [ ! -x "$exe" ]; then
+		printf "%-10s %16s\n" "$name" "not built"
+		continue
+	fi
+	out=$(dirname "$exe")/bench_out
+	cps=0
+	i=0
+	while [ $i -lt "$repeat" ]; do
+		run=$("$exe" -f "$frames" -o "$out" | sed -n 's/^cycles_per_second: //p')
+		if [ -n "$run" ] && [ "$run" -gt "$cps" ]; then cps=$run; fi
+		i=$((i + 1))
+	done
+	if [ -z "$base_cps" ]; then base_cps=$cps; fi
+	printf "%-10s %16s %9sx\n" "$name" "$cps" "$(awk "BEGIN { printf \"%.2f\", $cps / ($base_cps > 0 ? $base_cps : 1) }")"
+	if [ "$cps" -gt "$best_cps" ]; then
+		best_cps=$cps
+		best_name=$name
+		best_exe=$exe
+	fi
+done
+
+if [ -z "$best_exe" ]; then
+	echo "No variant ran"
+	exit 1
+fi
+ln -sf "$best_exe" ./Vtop_headless_threads
+echo "$best_name" > threads_best.txt
+echo "Best: $best_name ($best_cps cycles/s), linked as ./Vtop_headless_threads"